@@ -19,25 +19,19 @@
 
 if (NOT WIN32)
   find_package(PkgConfig)
-  pkg_check_modules(graphviz ${REQUIRED} libgvc libcdt libcgraph libpathplan)
+  pkg_check_modules(graphviz ${REQUIRED} libcdt libcgraph)
   if (GraphViz_FOUND)
     set (GraphViz_INCLUDE_DIRECTORIES ${GraphViz_INCLUDE_DIRS})
   endif (GraphViz_FOUND)
 endif (NOT WIN32)
     
 find_path(GraphViz_INCLUDE_DIRECTORIES
-  NAMES gvc.h
+  NAMES cgraph.h
   PATHS
   ${GraphViz_INCLUDE_DIRS}
   /usr/local/include/graphviz
   /usr/include/graphviz
 )
-    
-find_library(GraphViz_GVC_LIBRARY
-  NAMES gvc
-  PATHS
-  ${GraphViz_LIBRARY_DIRS}
-)
 
 find_library(GraphViz_CDT_LIBRARY
   NAMES cdt
@@ -51,27 +45,17 @@ find_library(GraphViz_GRAPH_LIBRARY
   ${GraphViz_LIBRARY_DIRS}
 )
 
-find_library(GraphViz_PATHPLAN_LIBRARY
-  NAMES pathplan
-  PATHS
-  ${GraphViz_LIBRARY_DIRS}
-)
-
 if (GraphViz_INCLUDE_DIRECTORIES AND
-    GraphViz_GVC_LIBRARY AND GraphViz_CDT_LIBRARY AND
-    GraphViz_GRAPH_LIBRARY AND GraphViz_PATHPLAN_LIBRARY)
+    GraphViz_CDT_LIBRARY AND GraphViz_GRAPH_LIBRARY)
   set (GraphViz_FOUND 1)
   set (GraphViz_LIBRARIES
-       "${GraphViz_GVC_LIBRARY};${GraphViz_GRAPH_LIBRARY};"
-       "${GraphViz_CDT_LIBRARY};${GraphViz_PATHPLAN_LIBRARY}"
+       "${GraphViz_GRAPH_LIBRARY};${GraphViz_CDT_LIBRARY}"
        CACHE FILEPATH "Libraries for graphviz")
 else (GraphViz_INCLUDE_DIRECTORIES AND
-      GraphViz_GVC_LIBRARY AND GraphViz_CDT_LIBRARY AND
-      GraphViz_GRAPH_LIBRARY AND GraphViz_PATHPLAN_LIBRARY)
+      GraphViz_CDT_LIBRARY AND GraphViz_GRAPH_LIBRARY)
   set (GraphViz_FOUND 0)
   if (GraphViz_FIND_REQUIRED)
     message (FATAL_ERROR "GraphViz not installed !")
   endif (GraphViz_FIND_REQUIRED)
 endif (GraphViz_INCLUDE_DIRECTORIES AND
-GraphViz_GVC_LIBRARY AND GraphViz_CDT_LIBRARY AND
-GraphViz_GRAPH_LIBRARY AND GraphViz_PATHPLAN_LIBRARY)
+GraphViz_CDT_LIBRARY AND GraphViz_GRAPH_LIBRARY)
@@ -0,0 +1,288 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphdata.h"
+
+#include <QQueue>
+
+bool ControlFlowGraphData::NodeKey::operator==(const NodeKey &other) const
+{
+    return cluster == other.cluster && declaration == other.declaration && label == other.label;
+}
+
+uint qHash(const ControlFlowGraphData::NodeKey &key)
+{
+    return (qHash(key.declaration) * 31 + qHash(key.label)) * 31 + key.cluster;
+}
+
+ControlFlowGraphData::ControlFlowGraphData()
+{
+}
+
+ControlFlowGraphData::~ControlFlowGraphData()
+{
+}
+
+int ControlFlowGraphData::cluster(const QStringList &containers)
+{
+    int parent = -1;
+    foreach (const QString &container, containers)
+        parent = childCluster(parent, container);
+    return parent;
+}
+
+int ControlFlowGraphData::childCluster(int parent, const QString &label)
+{
+    QPair<int, QString> key(parent, label);
+    QHash<QPair<int, QString>, int>::const_iterator it = m_clusterIds.constFind(key);
+    if (it != m_clusterIds.constEnd())
+        return *it;
+
+    Cluster cluster = { parent, label };
+    m_clusters.append(cluster);
+    m_clusterIds.insert(key, m_clusters.size() - 1);
+    return m_clusters.size() - 1;
+}
+
+int ControlFlowGraphData::node(int cluster, const IndexedDeclaration &key, const QString &label)
+{
+    NodeKey nodeKey;
+    nodeKey.cluster = cluster;
+    nodeKey.declaration = key;
+    if (!key.isValid())
+        nodeKey.label = label;
+
+    QHash<NodeKey, int>::const_iterator it = m_nodeIds.constFind(nodeKey);
+    if (it != m_nodeIds.constEnd())
+        return *it;
+
+    Node node = { cluster, key, IndexedDeclaration(), label };
+    m_nodes.append(node);
+    m_nodeIds.insert(nodeKey, m_nodes.size() - 1);
+    return m_nodes.size() - 1;
+}
+
+int ControlFlowGraphData::edge(int source, int target, int calls)
+{
+    QPair<int, int> key(source, target);
+    QHash<QPair<int, int>, int>::const_iterator it = m_edgeIds.constFind(key);
+    if (it != m_edgeIds.constEnd())
+    {
+        m_edges[*it].calls += calls;
+        return *it;
+    }
+
+    Edge edge = { source, target, calls };
+    m_edges.append(edge);
+    m_edgeIds.insert(key, m_edges.size() - 1);
+    return m_edges.size() - 1;
+}
+
+void ControlFlowGraphData::setNodeDeclaration(int node, const IndexedDeclaration &declaration)
+{
+    m_nodes[node].declaration = declaration;
+}
+
+void ControlFlowGraphData::setEdgeCalls(int edge, int calls)
+{
+    m_edges[edge].calls = calls;
+}
+
+void ControlFlowGraphData::removeCalls(int edge, int calls)
+{
+    m_edges[edge].calls -= calls;
+}
+
+QVector<int> ControlFlowGraphData::merge(const ControlFlowGraphData &other)
+{
+    QVector<int> clusterMap(other.m_clusters.size());
+    for (int i = 0; i < other.m_clusters.size(); ++i)
+    {
+        const Cluster &cluster = other.m_clusters[i];
+        clusterMap[i] = childCluster((cluster.parent == -1) ? -1 : clusterMap[cluster.parent], cluster.label);
+    }
+
+    QVector<int> nodeMap(other.m_nodes.size());
+    for (int i = 0; i < other.m_nodes.size(); ++i)
+    {
+        const Node &otherNode = other.m_nodes[i];
+        nodeMap[i] = node((otherNode.cluster == -1) ? -1 : clusterMap[otherNode.cluster], otherNode.key, otherNode.label);
+        if (!m_nodes[nodeMap[i]].declaration.isValid())
+            m_nodes[nodeMap[i]].declaration = otherNode.declaration;
+    }
+
+    QVector<int> edgeMap(other.m_edges.size());
+    for (int i = 0; i < other.m_edges.size(); ++i)
+    {
+        const Edge &otherEdge = other.m_edges[i];
+        edgeMap[i] = edge(nodeMap[otherEdge.source], nodeMap[otherEdge.target]);
+        m_edges[edgeMap[i]].calls += otherEdge.calls - 1;
+    }
+    return edgeMap;
+}
+
+void ControlFlowGraphData::prune(int rootNode, QVector<int> &nodeMap, QVector<int> &edgeMap, QVector<int> &clusterMap)
+{
+    QVector<QList<int> > callees(m_nodes.size()), callers(m_nodes.size());
+    foreach (const Edge &edge, m_edges)
+    {
+        if (edge.calls <= 0)
+            continue;
+        callees[edge.source].append(edge.target);
+        callers[edge.target].append(edge.source);
+    }
+
+    // Whatever the root calls is kept, and the incoming arcs leading to it
+    QVector<bool> reachable(m_nodes.size(), false);
+    reachable[rootNode] = true;
+    for (int direction = 0; direction < 2; ++direction)
+    {
+        const QVector<QList<int> > &neighbours = (direction == 0) ? callees : callers;
+        QVector<bool> visited(m_nodes.size(), false);
+        QQueue<int> pendingNodes;
+        visited[rootNode] = true;
+        pendingNodes.enqueue(rootNode);
+        while (!pendingNodes.isEmpty())
+            foreach (int node, neighbours[pendingNodes.dequeue()])
+                if (!visited[node])
+                {
+                    visited[node] = reachable[node] = true;
+                    pendingNodes.enqueue(node);
+                }
+    }
+
+    QVector<bool> usedClusters(m_clusters.size(), false);
+    for (int i = 0; i < m_nodes.size(); ++i)
+        if (reachable[i])
+            for (int cluster = m_nodes[i].cluster; cluster != -1 && !usedClusters[cluster]; cluster = m_clusters[cluster].parent)
+                usedClusters[cluster] = true;
+
+    // Interned again in their previous order, parents still precede their children
+    ControlFlowGraphData pruned;
+    clusterMap.fill(-1, m_clusters.size());
+    for (int i = 0; i < m_clusters.size(); ++i)
+        if (usedClusters[i])
+            clusterMap[i] = pruned.childCluster((m_clusters[i].parent == -1) ? -1 : clusterMap[m_clusters[i].parent], m_clusters[i].label);
+
+    nodeMap.fill(-1, m_nodes.size());
+    for (int i = 0; i < m_nodes.size(); ++i)
+    {
+        if (!reachable[i])
+            continue;
+        const Node &node = m_nodes[i];
+        nodeMap[i] = pruned.node((node.cluster == -1) ? -1 : clusterMap[node.cluster], node.key, node.label);
+        pruned.m_nodes[nodeMap[i]].declaration = node.declaration;
+    }
+
+    edgeMap.fill(-1, m_edges.size());
+    for (int i = 0; i < m_edges.size(); ++i)
+    {
+        const Edge &edge = m_edges[i];
+        if (edge.calls > 0 && reachable[edge.source] && reachable[edge.target])
+            edgeMap[i] = pruned.edge(nodeMap[edge.source], nodeMap[edge.target], edge.calls);
+    }
+
+    *this = pruned;
+}
+
+int ControlFlowGraphData::findEdge(int source, int target) const
+{
+    return m_edgeIds.value(QPair<int, int>(source, target), -1);
+}
+
+int ControlFlowGraphData::nodeFromName(const QString &name) const
+{
+    bool ok = false;
+    int node = name.startsWith('n') ? name.mid(1).toInt(&ok) : -1;
+    return (ok && node >= 0 && node < m_nodes.size()) ? node : -1;
+}
+
+int ControlFlowGraphData::edgeFromName(const QString &name) const
+{
+    QStringList nodes = name.split("->");
+    if (nodes.size() != 2)
+        return -1;
+    return findEdge(nodeFromName(nodes[0]), nodeFromName(nodes[1]));
+}
+
+QString ControlFlowGraphData::nodeName(int node)
+{
+    return 'n' + QString::number(node);
+}
+
+QString ControlFlowGraphData::edgeName(int source, int target)
+{
+    return nodeName(source) + "->" + nodeName(target);
+}
+
+QString ControlFlowGraphData::edgeLabel(int edge) const
+{
+    return m_nodes[m_edges[edge].source].label + "->" + m_nodes[m_edges[edge].target].label;
+}
+
+const QVector<ControlFlowGraphData::Cluster> &ControlFlowGraphData::clusters() const
+{
+    return m_clusters;
+}
+
+const QVector<ControlFlowGraphData::Node> &ControlFlowGraphData::nodes() const
+{
+    return m_nodes;
+}
+
+const QVector<ControlFlowGraphData::Edge> &ControlFlowGraphData::edges() const
+{
+    return m_edges;
+}
+
+bool ControlFlowGraphData::hasSameGraph(const ControlFlowGraphData &other) const
+{
+    if (m_clusters.size() != other.m_clusters.size() || m_nodes.size() != other.m_nodes.size() || m_edges.size() != other.m_edges.size())
+        return false;
+
+    for (int i = 0; i < m_clusters.size(); ++i)
+        if (m_clusters[i].parent != other.m_clusters[i].parent || m_clusters[i].label != other.m_clusters[i].label)
+            return false;
+
+    for (int i = 0; i < m_nodes.size(); ++i)
+        if (m_nodes[i].cluster != other.m_nodes[i].cluster || m_nodes[i].label != other.m_nodes[i].label)
+            return false;
+
+    for (int i = 0; i < m_edges.size(); ++i)
+        if (m_edges[i].source != other.m_edges[i].source || m_edges[i].target != other.m_edges[i].target ||
+            m_edges[i].calls != other.m_edges[i].calls)
+            return false;
+
+    return true;
+}
+
+bool ControlFlowGraphData::isEmpty() const
+{
+    return m_nodes.isEmpty();
+}
+
+void ControlFlowGraphData::clear()
+{
+    m_clusters.clear();
+    m_nodes.clear();
+    m_edges.clear();
+    m_clusterIds.clear();
+    m_nodeIds.clear();
+    m_edgeIds.clear();
+}
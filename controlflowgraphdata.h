@@ -0,0 +1,118 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHDATA_H
+#define CONTROLFLOWGRAPHDATA_H
+
+#include <QHash>
+#include <QPair>
+#include <QVector>
+#include <QMetaType>
+#include <QString>
+#include <QStringList>
+
+#include <language/duchain/ducontext.h>
+
+using namespace KDevelop;
+
+// Graphviz-independent representation of a control flow graph. Nodes, clusters and
+// edges are interned once and referred to by their index in flat arrays, so the
+// traversal never touches cgraph and DotControlFlowGraph builds it in a single pass.
+class ControlFlowGraphData
+{
+public:
+    struct Cluster
+    {
+        int parent; // -1 for clusters placed directly in the root graph
+        QString label;
+    };
+    struct Node
+    {
+        int cluster; // -1 for nodes placed directly in the root graph
+        IndexedDeclaration key;
+        IndexedDeclaration declaration; // Declaration used for navigation
+        QString label;
+    };
+    struct Edge
+    {
+        int source;
+        int target;
+        int calls; // Number of times the edge was added, one per call site
+    };
+
+    ControlFlowGraphData();
+    ~ControlFlowGraphData();
+
+    // Returns the innermost cluster for the given container path, creating it if needed
+    int cluster(const QStringList &containers);
+    // Nodes with a valid key are identified by it, otherwise by their label
+    int node(int cluster, const IndexedDeclaration &key, const QString &label);
+    // Adds calls call sites to the edge, creating it if needed
+    int edge(int source, int target, int calls = 1);
+    void setNodeDeclaration(int node, const IndexedDeclaration &declaration);
+    void setEdgeCalls(int edge, int calls);
+    // Takes back calls call sites from the edge, it is dropped by prune() once none are left
+    void removeCalls(int edge, int calls);
+    // Interns everything from other, appending its new elements in their original order.
+    // Returns the merged id of each edge of other
+    QVector<int> merge(const ControlFlowGraphData &other);
+    // Drops edges without calls, then the nodes and clusters neither reached from rootNode nor leading to it.
+    // The maps give the new index of every previous element, -1 for dropped ones
+    void prune(int rootNode, QVector<int> &nodeMap, QVector<int> &edgeMap, QVector<int> &clusterMap);
+
+    int findEdge(int source, int target) const;
+    int nodeFromName(const QString &name) const;
+    int edgeFromName(const QString &name) const;
+    static QString nodeName(int node);
+    static QString edgeName(int source, int target);
+    QString edgeLabel(int edge) const;
+
+    const QVector<Cluster> &clusters() const;
+    const QVector<Node> &nodes() const;
+    const QVector<Edge> &edges() const;
+
+    // Compares what is displayed, navigation declarations are ignored
+    bool hasSameGraph(const ControlFlowGraphData &other) const;
+    bool isEmpty() const;
+    void clear();
+private:
+    struct NodeKey
+    {
+        int cluster;
+        IndexedDeclaration declaration;
+        QString label;
+        bool operator==(const NodeKey &other) const;
+    };
+    friend uint qHash(const NodeKey &key);
+
+    int childCluster(int parent, const QString &label);
+
+    QVector<Cluster> m_clusters;
+    QVector<Node> m_nodes;
+    QVector<Edge> m_edges;
+
+    QHash<QPair<int, QString>, int> m_clusterIds;
+    QHash<NodeKey, int> m_nodeIds;
+    QHash<QPair<int, int>, int> m_edgeIds;
+};
+
+// Snapshots are posted to the GUI thread while a graph is generated
+Q_DECLARE_METATYPE(ControlFlowGraphData)
+
+#endif
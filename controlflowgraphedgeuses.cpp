@@ -0,0 +1,196 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphedgeuses.h"
+
+#include <language/duchain/declaration.h>
+#include <language/duchain/topducontext.h>
+
+using namespace KDevelop;
+
+namespace {
+    // The navigation context lists the uses last first
+    bool useLessThan(const QPair<RangeInRevision, IndexedString> &first, const QPair<RangeInRevision, IndexedString> &second)
+    {
+        if (first.second != second.second)
+            return first.second.str() > second.second.str();
+        return second.first.start < first.first.start;
+    }
+}
+
+bool ControlFlowGraphEdgeUses::UseSite::operator==(const UseSite &other) const
+{
+    return url == other.url && range == other.range;
+}
+
+uint qHash(const ControlFlowGraphEdgeUses::UseSite &useSite)
+{
+    return useSite.url.hash() ^ (useSite.range.start.line << 12) ^ useSite.range.start.column ^
+           (useSite.range.end.line << 20) ^ (useSite.range.end.column << 8);
+}
+
+ControlFlowGraphEdgeUses::ControlFlowGraphEdgeUses()
+: m_lazy(false)
+{
+}
+
+ControlFlowGraphEdgeUses::~ControlFlowGraphEdgeUses()
+{
+}
+
+void ControlFlowGraphEdgeUses::setLazy(bool lazy)
+{
+    m_lazy = lazy;
+}
+
+bool ControlFlowGraphEdgeUses::isLazy() const
+{
+    return m_lazy;
+}
+
+void ControlFlowGraphEdgeUses::addUse(int edge, const Call &call, const IndexedString &url, const RangeInRevision &range, int calls)
+{
+    if (m_lazy)
+    {
+        m_calls[edge][call] += calls;
+        m_useCounts[edge] += calls;
+    }
+    // Calls read from the call graph index have no use range
+    else if (!(range == RangeInRevision::invalid()))
+    {
+        UseSite useSite = { url, range };
+        m_useSites[edge][call.first].insert(useSite);
+    }
+}
+
+int ControlFlowGraphEdgeUses::useCount(int edge) const
+{
+    if (m_lazy)
+        return m_useCounts.value(edge);
+
+    int count = 0;
+    foreach (const QSet<UseSite> &useSites, m_useSites.value(edge))
+        count += useSites.size();
+    return count;
+}
+
+QHash<ControlFlowGraphEdgeUses::Call, int> ControlFlowGraphEdgeUses::calls(int edge) const
+{
+    return m_calls.value(edge);
+}
+
+void ControlFlowGraphEdgeUses::removeCaller(int edge, const IndexedDeclaration &caller)
+{
+    if (!m_lazy)
+    {
+        QHash<int, QHash<IndexedDeclaration, QSet<UseSite> > >::iterator useSites = m_useSites.find(edge);
+        if (useSites != m_useSites.end())
+            useSites->remove(caller);
+        return;
+    }
+
+    QHash<int, QHash<Call, int> >::iterator calls = m_calls.find(edge);
+    if (calls == m_calls.end())
+        return;
+    QHash<Call, int>::iterator it = calls->begin();
+    while (it != calls->end())
+    {
+        if (it.key().first == caller)
+        {
+            m_useCounts[edge] -= it.value();
+            it = calls->erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+void ControlFlowGraphEdgeUses::remapEdges(const QVector<int> &edgeMap)
+{
+    QHash<int, QHash<IndexedDeclaration, QSet<UseSite> > > useSites;
+    QHash<int, QHash<Call, int> > calls;
+    QHash<int, int> useCounts;
+    for (int edge = 0; edge < edgeMap.size(); ++edge)
+    {
+        if (edgeMap[edge] == -1)
+            continue;
+        if (m_useSites.contains(edge))
+            useSites.insert(edgeMap[edge], m_useSites.value(edge));
+        if (m_calls.contains(edge))
+            calls.insert(edgeMap[edge], m_calls.value(edge));
+        if (m_useCounts.contains(edge))
+            useCounts.insert(edgeMap[edge], m_useCounts.value(edge));
+    }
+    m_useSites = useSites;
+    m_calls = calls;
+    m_useCounts = useCounts;
+}
+
+ControlFlowGraphNavigationContext::ArcUses ControlFlowGraphEdgeUses::uses(int edge) const
+{
+    QSet<UseSite> useSites;
+    if (m_lazy)
+    {
+        foreach (const Call &call, m_calls.value(edge).keys())
+        {
+            Declaration *caller = call.first.data();
+            Declaration *callee = call.second.data();
+            if (!caller || !callee || !caller->internalContext())
+                continue;
+
+            QVector<Use> callerUses;
+            findUses(caller->topContext(), caller->internalContext(), callee, callerUses);
+            foreach (const Use &use, callerUses)
+            {
+                UseSite useSite = { caller->url(), use.m_range };
+                useSites.insert(useSite);
+            }
+        }
+    }
+    else
+        foreach (const QSet<UseSite> &callerUseSites, m_useSites.value(edge))
+            useSites.unite(callerUseSites);
+
+    ControlFlowGraphNavigationContext::ArcUses arcUses;
+    foreach (const UseSite &useSite, useSites)
+        arcUses.append(qMakePair(useSite.range, useSite.url));
+
+    qSort(arcUses.begin(), arcUses.end(), useLessThan);
+    return arcUses;
+}
+
+void ControlFlowGraphEdgeUses::clear()
+{
+    m_useSites.clear();
+    m_calls.clear();
+    m_useCounts.clear();
+}
+
+void ControlFlowGraphEdgeUses::findUses(TopDUContext *topContext, DUContext *context, Declaration *declaration, QVector<Use> &uses)
+{
+    const Use *contextUses = context->uses();
+    int usesCount = context->usesCount();
+    for (int i = 0; i < usesCount; ++i)
+        if (topContext->usedDeclarationForIndex(contextUses[i].m_declarationIndex) == declaration)
+            uses.append(contextUses[i]);
+
+    foreach (DUContext *child, context->childContexts())
+        if (child->type() == DUContext::Other)
+            findUses(topContext, child, declaration, uses);
+}
@@ -0,0 +1,81 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHEDGEUSES_H
+#define CONTROLFLOWGRAPHEDGEUSES_H
+
+#include <QSet>
+#include <QHash>
+#include <QPair>
+#include <QVector>
+
+#include <language/duchain/use.h>
+#include <language/duchain/ducontext.h>
+#include <language/duchain/indexedstring.h>
+
+#include "controlflowgraphnavigationcontext.h"
+
+using namespace KDevelop;
+
+// Call sites behind the edges of a graph, keyed by edge id and only read when the user hovers
+// an edge. A lazy store just counts the calls and keeps which declaration calls which, the use
+// ranges are searched again in the caller bodies when they are asked for.
+class ControlFlowGraphEdgeUses
+{
+public:
+    // Calling definition and called declaration
+    typedef QPair<IndexedDeclaration, IndexedDeclaration> Call;
+
+    ControlFlowGraphEdgeUses();
+    ~ControlFlowGraphEdgeUses();
+
+    void setLazy(bool lazy);
+    bool isLazy() const;
+
+    // Lazy stores count calls call sites, others only keep valid ranges
+    void addUse(int edge, const Call &call, const IndexedString &url, const RangeInRevision &range, int calls = 1);
+    int useCount(int edge) const;
+    // Calls behind the edge with their number of call sites, lazy stores only
+    QHash<Call, int> calls(int edge) const;
+    // Forgets the uses caller made through edge, when its body is walked again
+    void removeCaller(int edge, const IndexedDeclaration &caller);
+    // Moves every edge to its index in edgeMap, edges mapped to -1 are dropped
+    void remapEdges(const QVector<int> &edgeMap);
+    // The DUChain must be read locked for lazy stores
+    ControlFlowGraphNavigationContext::ArcUses uses(int edge) const;
+    void clear();
+
+    static void findUses(TopDUContext *topContext, DUContext *context, Declaration *declaration, QVector<Use> &uses);
+private:
+    struct UseSite
+    {
+        IndexedString url;
+        RangeInRevision range;
+        bool operator==(const UseSite &other) const;
+    };
+    friend uint qHash(const UseSite &useSite);
+
+    bool m_lazy;
+    // By calling declaration, so the uses of a single caller can be taken back
+    QHash<int, QHash<IndexedDeclaration, QSet<UseSite> > > m_useSites;
+    QHash<int, QHash<Call, int> > m_calls;
+    QHash<int, int> m_useCounts;
+};
+
+#endif
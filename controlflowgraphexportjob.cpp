@@ -0,0 +1,529 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphexportjob.h"
+
+#include <QThread>
+#include <QtConcurrentRun>
+#include <QFutureSynchronizer>
+
+#include <KLocale>
+#include <KDebug>
+
+#include <ThreadWeaver/Weaver>
+
+#include <interfaces/icore.h>
+#include <interfaces/iproject.h>
+#include <interfaces/iuicontroller.h>
+
+#include <language/duchain/duchain.h>
+#include <language/duchain/codemodel.h>
+#include <language/duchain/declaration.h>
+#include <language/duchain/duchainlock.h>
+#include <language/duchain/duchainutils.h>
+#include <language/duchain/functiondefinition.h>
+#include <language/duchain/persistentsymboltable.h>
+#include <language/duchain/classfunctiondeclaration.h>
+
+#include "controlflowgraphtraversal.h"
+#include "dotcontrolflowgraph.h"
+#include "controlflowgraphdata.h"
+#include "controlflowgraphedgeuses.h"
+#include "controlflowgraphindex.h"
+#include "controlflowgraphfiledialog.h"
+#include "controlflowgraphlocationresolver.h"
+#include "duchaincontrolflowinternaljob.h"
+#include "kdevcontrolflowgraphviewplugin.h"
+
+namespace {
+    bool indexedStringLessThan(const IndexedString &first, const IndexedString &second)
+    {
+        return first.str() < second.str();
+    }
+}
+
+ControlFlowGraphExportJob::ControlFlowGraphExportJob(KDevControlFlowGraphViewPlugin *plugin, const QString &jobName, ControlFlowGraphFileDialog *fileDialog)
+: m_plugin(plugin),
+  m_exportType(ExportFunction),
+  m_exportFiles(fileDialog->exportFiles()),
+  m_dotControlFlowGraph(new DotControlFlowGraph),
+  m_traversal(new ControlFlowGraphTraversal(m_dotControlFlowGraph->graphData())),
+  m_hit(ControlFlowGraphRenderCache::Miss),
+  m_abort(false),
+  m_projectProgressMax(0)
+{
+    ControlFlowGraphTraversal::Settings settings;
+    settings.controlFlowMode = fileDialog->controlFlowMode();
+    settings.clusteringModes = fileDialog->clusteringModes();
+    settings.maxLevel = fileDialog->maxLevel();
+    settings.useFolderName = fileDialog->useFolderName();
+    settings.useShortNames = fileDialog->useShortNames();
+    settings.drawIncomingArcs = fileDialog->drawIncomingArcs();
+    settings.maxCallerLevel = fileDialog->maxCallerLevel();
+    // Exported graphs are never hovered
+    settings.lazyEdgeUses = true;
+    m_traversal->setSettings(settings);
+    m_dotControlFlowGraph->setLayoutEngine(fileDialog->layoutEngine());
+    m_dotControlFlowGraph->setLayoutThresholds(fileDialog->fastLayoutNodes(), fileDialog->sfdpLayoutNodes());
+    m_dotControlFlowGraph->setNodeBudget(fileDialog->nodeBudget());
+    m_traversal->setLocationResolver(m_plugin->locationResolver());
+
+    m_dotControlFlowGraph->prepareNewGraph();
+    init(jobName);
+}
+
+ControlFlowGraphExportJob::ControlFlowGraphExportJob(KDevControlFlowGraphViewPlugin *plugin, const QString &jobName,
+                                                     const DotControlFlowGraph *dotControlFlowGraph, const QStringList &exportFiles)
+: m_plugin(plugin),
+  m_exportType(ExportGraph),
+  m_exportFiles(exportFiles),
+  m_dotControlFlowGraph(new DotControlFlowGraph),
+  m_traversal(0),
+  m_hit(ControlFlowGraphRenderCache::Miss),
+  m_abort(false),
+  m_projectProgressMax(0)
+{
+    m_dotControlFlowGraph->copyGraph(dotControlFlowGraph);
+    init(jobName);
+}
+
+void ControlFlowGraphExportJob::init(const QString &jobName)
+{
+    setObjectName(i18n("Exporting control flow graph for %1", jobName));
+    setCapabilities(Killable);
+    setAutoDelete(false);
+    ICore::self()->uiController()->registerStatus(this);
+}
+
+ControlFlowGraphExportJob::~ControlFlowGraphExportJob()
+{
+    delete m_traversal;
+    delete m_dotControlFlowGraph;
+}
+
+void ControlFlowGraphExportJob::setFunction(const IndexedDeclaration &definition)
+{
+    m_exportType = ExportFunction;
+    m_ideclaration = definition;
+}
+
+void ControlFlowGraphExportJob::setClass(const IndexedDeclaration &declaration)
+{
+    m_exportType = ExportClass;
+    m_ideclaration = declaration;
+}
+
+void ControlFlowGraphExportJob::setProject(IProject *project, ControlFlowGraphIndex *callGraphIndex)
+{
+    m_exportType = ExportProject;
+    m_project = project;
+    m_callGraphIndex = callGraphIndex;
+    // Read here, project models are only safe to use from the GUI thread
+    m_projectFiles = project->fileSet().toList();
+    if (callGraphIndex)
+        callGraphIndex->updateProjectFiles();
+}
+
+QString ControlFlowGraphExportJob::statusName() const
+{
+    return i18n("Control Flow Graph");
+}
+
+QString ControlFlowGraphExportJob::selectedFile() const
+{
+    return m_exportFiles.isEmpty() ? QString() : m_exportFiles.first();
+}
+
+ControlFlowGraphRenderCache::Hit ControlFlowGraphExportJob::hit() const
+{
+    return m_hit;
+}
+
+bool ControlFlowGraphExportJob::isAborted() const
+{
+    return m_abort;
+}
+
+void ControlFlowGraphExportJob::start()
+{
+    emit showMessage(this, i18n("Waiting to export %1", selectedFile()));
+    m_plugin->scheduleExport(this);
+}
+
+void ControlFlowGraphExportJob::run()
+{
+    emit showProgress(this, 0, 0, 0);
+    emit showMessage(this, objectName());
+
+    // Folder names come from the exported project, or the one of the exported declaration. Its include
+    // directories can only be read from the GUI thread
+    if (m_traversal)
+    {
+        IProject *project = m_project;
+        if (!project)
+        {
+            IndexedString url;
+            {
+                DUChainReadLocker readLock(DUChain::lock());
+                if (Declaration *declaration = m_ideclaration.data())
+                    url = declaration->url();
+            }
+            if (!url.isEmpty())
+                project = m_plugin->locationResolver()->projectForUrl(url);
+        }
+        m_plugin->locationResolver()->prepareProject(project);
+        m_traversal->setProject(project);
+    }
+
+    m_internalJob = new DUChainControlFlowInternalJob(0, this);
+    connect(m_internalJob, SIGNAL(done(ThreadWeaver::Job*)), SLOT(done(ThreadWeaver::Job*)));
+    ThreadWeaver::Weaver::instance()->enqueue(m_internalJob);
+}
+
+bool ControlFlowGraphExportJob::doKill()
+{
+    // A waiting export never started, a running one finishes through done() once it notices the abort
+    if (m_plugin->unscheduleExport(this))
+    {
+        emit clearMessage(this);
+        return true;
+    }
+    requestAbort();
+    return false;
+}
+
+void ControlFlowGraphExportJob::requestAbort()
+{
+    kDebug() << "Requesting abort";
+    m_abort = true;
+    if (m_traversal)
+        m_traversal->requestAbort();
+
+    QMutexLocker locker(&m_shardTraversalsMutex);
+    foreach (ControlFlowGraphTraversal *traversal, m_shardTraversals)
+        traversal->requestAbort();
+}
+
+void ControlFlowGraphExportJob::done(ThreadWeaver::Job *job)
+{
+    job->deleteLater();
+    emit hideProgress(this);
+    // exportGraph() leaves its render cache status shown for a while
+    if (m_abort)
+        emit clearMessage(this);
+
+    emitResult();
+}
+
+void ControlFlowGraphExportJob::generate()
+{
+    switch (m_exportType)
+    {
+        case ExportGraph:
+        {
+            exportGraph();
+            break;
+        }
+        case ExportFunction:
+        {
+            generateFunctionControlFlowGraph();
+            break;
+        }
+        case ExportClass:
+        {
+            generateClassControlFlowGraph();
+            break;
+        }
+        case ExportProject:
+        {
+            generateProjectControlFlowGraph();
+            break;
+        }
+    };
+}
+
+void ControlFlowGraphExportJob::generateFunctionControlFlowGraph()
+{
+    {
+        DUChainReadLocker readLock(DUChain::lock());
+        if (!m_ideclaration.data())
+            return;
+    }
+
+    // Locks the DUChain by itself, releasing it now and then
+    m_traversal->generateControlFlowForDefinition(m_ideclaration);
+    m_traversal->collectIncomingArcs();
+    if (!m_abort)
+        exportGraph();
+}
+
+void ControlFlowGraphExportJob::generateClassControlFlowGraph()
+{
+    QList<IndexedDeclaration> functionDefinitions;
+    QStringList functionNames;
+    {
+        DUChainReadLocker readLock(DUChain::lock());
+
+        Declaration *declaration = m_ideclaration.data();
+        if (!declaration)
+            return;
+
+        if (!declaration->isForwardDeclaration() && declaration->internalContext())
+        {
+            // For each function declaration
+            ClassFunctionDeclaration *functionDeclaration;
+            foreach (Declaration *decl, declaration->internalContext()->localDeclarations())
+            {
+                if ((functionDeclaration = dynamic_cast<ClassFunctionDeclaration *>(decl)))
+                {
+                    Declaration *functionDefinition = FunctionDefinition::definition(functionDeclaration);
+                    if (functionDefinition)
+                    {
+                        functionDefinitions.append(IndexedDeclaration(functionDefinition));
+                        functionNames.append(decl->identifier().toString());
+                    }
+                }
+            }
+        }
+    }
+
+    int max = functionDefinitions.size();
+    for (int i = 0; i < max && !m_abort; ++i)
+    {
+        emit showProgress(this, 0, max-1, i);
+        emit showMessage(this, i18n("Generating graph for function %1", functionNames[i]));
+        m_traversal->generateControlFlowForDefinition(functionDefinitions[i]);
+    }
+    m_traversal->collectIncomingArcs();
+    if (!m_abort)
+    {
+        emit showMessage(this, i18n("Saving file %1", selectedFile()));
+        exportGraph();
+    }
+}
+
+void ControlFlowGraphExportJob::generateProjectControlFlowGraph()
+{
+    // With a complete call graph index no function body has to be walked again
+    ControlFlowGraphIndex *callGraphIndex = m_callGraphIndex;
+    if (callGraphIndex && !callGraphIndex->isComplete())
+        callGraphIndex = 0;
+
+    QList<IndexedDeclaration> roots;
+    QList<IndexedString> files;
+    if (callGraphIndex)
+        roots = callGraphIndex->allCallers();
+    else
+    {
+        files = m_projectFiles;
+        qSort(files.begin(), files.end(), indexedStringLessThan);
+    }
+
+    // Each shard traverses a contiguous slice into its own graph. Shards are merged in order,
+    // so the result doesn't depend on which thread finished first.
+    int shardCount = qMax(1, QThread::idealThreadCount());
+    m_projectProgress = 0;
+    m_projectProgressMax = roots.size() + files.size();
+
+    QVector<ControlFlowGraphData *> shardGraphs(shardCount);
+    QVector<ControlFlowGraphEdgeUses *> shardEdgeUses(shardCount);
+    QFutureSynchronizer<void> synchronizer;
+    for (int shard = 0; shard < shardCount; ++shard)
+    {
+        int rootsBegin = roots.size() * shard / shardCount, rootsEnd = roots.size() * (shard + 1) / shardCount;
+        int filesBegin = files.size() * shard / shardCount, filesEnd = files.size() * (shard + 1) / shardCount;
+        shardGraphs[shard] = new ControlFlowGraphData;
+        shardEdgeUses[shard] = new ControlFlowGraphEdgeUses;
+        synchronizer.addFuture(QtConcurrent::run(this, &ControlFlowGraphExportJob::generateProjectShard,
+                                                 roots.mid(rootsBegin, rootsEnd - rootsBegin),
+                                                 files.mid(filesBegin, filesEnd - filesBegin),
+                                                 shardGraphs[shard], shardEdgeUses[shard], callGraphIndex));
+    }
+    synchronizer.waitForFinished();
+
+    // A function reached from several shards is expanded by each of them, so the calls behind a
+    // merged edge are counted once per calling definition and called declaration
+    ControlFlowGraphData *graphData = m_dotControlFlowGraph->graphData();
+    QVector<QHash<ControlFlowGraphEdgeUses::Call, int> > edgeCalls;
+    for (int shard = 0; shard < shardCount; ++shard)
+    {
+        QVector<int> edgeMap = graphData->merge(*shardGraphs[shard]);
+        edgeCalls.resize(graphData->edges().size());
+        for (int edge = 0; edge < edgeMap.size(); ++edge)
+        {
+            QHash<ControlFlowGraphEdgeUses::Call, int> &mergedCalls = edgeCalls[edgeMap[edge]];
+            QHash<ControlFlowGraphEdgeUses::Call, int> calls = shardEdgeUses[shard]->calls(edge);
+            QHash<ControlFlowGraphEdgeUses::Call, int>::const_iterator it;
+            for (it = calls.constBegin(); it != calls.constEnd(); ++it)
+                mergedCalls[it.key()] = qMax(mergedCalls.value(it.key()), it.value());
+        }
+        delete shardGraphs[shard];
+        delete shardEdgeUses[shard];
+    }
+    for (int edge = 0; edge < edgeCalls.size(); ++edge)
+    {
+        int calls = 0;
+        foreach (int callSites, edgeCalls[edge])
+            calls += callSites;
+        if (calls)
+            graphData->setEdgeCalls(edge, calls);
+    }
+
+    if (!m_abort)
+    {
+        emit showMessage(this, i18n("Saving file %1", selectedFile()));
+        exportGraph();
+    }
+}
+
+void ControlFlowGraphExportJob::generateProjectShard(QList<IndexedDeclaration> roots, QList<IndexedString> files, ControlFlowGraphData *graphData,
+                                                     ControlFlowGraphEdgeUses *edgeUses, ControlFlowGraphIndex *callGraphIndex)
+{
+    ControlFlowGraphTraversal traversal(graphData);
+    traversal.setSettings(m_traversal->settings());
+    traversal.setProject(m_traversal->project());
+    traversal.setLocationResolver(m_traversal->locationResolver());
+    traversal.setCallGraphIndex(callGraphIndex);
+
+    {
+        QMutexLocker locker(&m_shardTraversalsMutex);
+        // The abort may have come before the shard was registered
+        if (m_abort)
+            return;
+        m_shardTraversals.append(&traversal);
+    }
+
+    if (callGraphIndex)
+        generateProjectControlFlowGraphFromIndex(&traversal, roots);
+    else
+        generateProjectControlFlowGraphFromDUChain(&traversal, files);
+    traversal.collectIncomingArcs();
+    *edgeUses = traversal.edgeUses();
+
+    QMutexLocker locker(&m_shardTraversalsMutex);
+    m_shardTraversals.removeOne(&traversal);
+}
+
+void ControlFlowGraphExportJob::generateProjectControlFlowGraphFromIndex(ControlFlowGraphTraversal *traversal, const QList<IndexedDeclaration> &roots)
+{
+    // For each function definition making calls
+    foreach (const IndexedDeclaration &root, roots)
+    {
+        if (m_abort)
+            break;
+
+        emit showProgress(this, 0, m_projectProgressMax-1, m_projectProgress.fetchAndAddOrdered(1));
+
+        {
+            DUChainReadLocker readLock(DUChain::lock());
+
+            Declaration *functionDefinition = root.data();
+            if (!functionDefinition || !functionDefinition->internalContext())
+                continue;
+
+            // Only class methods are graph roots, as when walking the code model
+            if (!dynamic_cast<ClassFunctionDeclaration *>(DUChainUtils::declarationForDefinition(functionDefinition, functionDefinition->topContext())))
+                continue;
+
+            emit showMessage(this, i18n("Generating graph for %1 - %2", functionDefinition->url().str(), functionDefinition->qualifiedIdentifier().toString()));
+        }
+
+        // Locks the DUChain by itself, releasing it now and then
+        traversal->generateControlFlowForDefinition(root);
+    }
+}
+
+void ControlFlowGraphExportJob::generateProjectControlFlowGraphFromDUChain(ControlFlowGraphTraversal *traversal, const QList<IndexedString> &files)
+{
+    // For each source file
+    foreach(const IndexedString &file, files)
+    {
+        if (m_abort)
+            break;
+
+        emit showProgress(this, 0, m_projectProgressMax-1, m_projectProgress.fetchAndAddOrdered(1));
+
+        // Class methods of the file are collected first, the graphs are then generated without holding the DUChain lock
+        QList<IndexedDeclaration> functionDefinitions;
+        QStringList functionNames;
+        {
+            DUChainReadLocker readLock(DUChain::lock());
+
+            uint codeModelItemCount = 0;
+            const CodeModelItem *codeModelItems = 0;
+            CodeModel::self().items(file, codeModelItemCount, codeModelItems);
+
+            for (uint codeModelItemIndex = 0; codeModelItemIndex < codeModelItemCount; ++codeModelItemIndex)
+            {
+                const CodeModelItem &item = codeModelItems[codeModelItemIndex];
+
+                if ((item.kind & CodeModelItem::Class) && !item.id.identifier().last().toString().isEmpty())
+                {
+                    uint declarationCount = 0;
+                    const IndexedDeclaration *declarations = 0;
+                    PersistentSymbolTable::self().declarations(item.id.identifier(), declarationCount, declarations);
+                    // For each class declaration
+                    for (uint j = 0; j < declarationCount; ++j)
+                    {
+                        Declaration *declaration = dynamic_cast<Declaration *>(declarations[j].declaration());
+                        if (declaration && !declaration->isForwardDeclaration() && declaration->internalContext())
+                        {
+                            // For each function declaration
+                            ClassFunctionDeclaration *functionDeclaration;
+                            foreach (Declaration *decl, declaration->internalContext()->localDeclarations())
+                            {
+                                if ((functionDeclaration = dynamic_cast<ClassFunctionDeclaration *>(decl)))
+                                {
+                                    Declaration *functionDefinition = FunctionDefinition::definition(functionDeclaration);
+                                    if (functionDefinition)
+                                    {
+                                        functionDefinitions.append(IndexedDeclaration(functionDefinition));
+                                        functionNames.append(decl->qualifiedIdentifier().toString());
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < functionDefinitions.size() && !m_abort; ++i)
+        {
+            emit showMessage(this, i18n("Generating graph for %1 - %2", file.str(), functionNames[i]));
+            traversal->generateControlFlowForDefinition(functionDefinitions[i]);
+        }
+    }
+}
+
+void ControlFlowGraphExportJob::exportGraph()
+{
+    m_hit = m_dotControlFlowGraph->exportGraph(m_exportFiles, m_plugin->renderCache());
+
+    if (m_hit == ControlFlowGraphRenderCache::Failed)
+        emit showMessage(this, i18n("Could not lay out %1, graphviz failed or exceeded its limits", selectedFile()), 5000);
+    else if (m_hit == ControlFlowGraphRenderCache::RenderHit)
+        emit showMessage(this, i18n("Saved file %1 from the render cache", selectedFile()), 5000);
+    else if (m_hit == ControlFlowGraphRenderCache::Streamed)
+        emit showMessage(this, i18n("Saved file %1", selectedFile()), 5000);
+    else if (m_hit == ControlFlowGraphRenderCache::LayoutHit)
+        emit showMessage(this, i18n("Saved file %1 using a cached layout", selectedFile()), 5000);
+    else
+        emit showMessage(this, i18n("Saved file %1, not found in the render cache", selectedFile()), 5000);
+}
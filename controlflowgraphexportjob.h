@@ -0,0 +1,132 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHEXPORTJOB_H
+#define CONTROLFLOWGRAPHEXPORTJOB_H
+
+#include <QMutex>
+#include <QPointer>
+#include <QAtomicInt>
+#include <QStringList>
+
+#include <KJob>
+
+#include <interfaces/istatus.h>
+#include <language/duchain/indexeddeclaration.h>
+#include <language/duchain/indexedstring.h>
+
+#include "controlflowgraphrendercache.h"
+
+namespace ThreadWeaver
+{
+    class Job;
+}
+
+namespace KDevelop
+{
+    class IProject;
+}
+
+class ControlFlowGraphTraversal;
+class DotControlFlowGraph;
+class ControlFlowGraphData;
+class ControlFlowGraphEdgeUses;
+class ControlFlowGraphIndex;
+class ControlFlowGraphFileDialog;
+class DUChainControlFlowInternalJob;
+class KDevControlFlowGraphViewPlugin;
+
+using namespace KDevelop;
+
+// A single export, owning its traversal, graph and output settings, so several of them can be
+// generated and rendered at once. The plugin starts at most a few at a time, the others wait.
+class ControlFlowGraphExportJob : public KJob, public IStatus
+{
+    Q_OBJECT
+    Q_INTERFACES(KDevelop::IStatus)
+public:
+    // Settings and files are taken from fileDialog, which can be deleted afterwards
+    ControlFlowGraphExportJob(KDevControlFlowGraphViewPlugin *plugin, const QString &jobName, ControlFlowGraphFileDialog *fileDialog);
+    // Renders a copy of a graph already generated, such as the one shown by a tool view
+    ControlFlowGraphExportJob(KDevControlFlowGraphViewPlugin *plugin, const QString &jobName, const DotControlFlowGraph *dotControlFlowGraph,
+                              const QStringList &exportFiles);
+    virtual ~ControlFlowGraphExportJob();
+
+    void setFunction(const IndexedDeclaration &definition);
+    void setClass(const IndexedDeclaration &declaration);
+    void setProject(IProject *project, ControlFlowGraphIndex *callGraphIndex);
+
+    virtual QString statusName() const;
+    QString selectedFile() const;
+    ControlFlowGraphRenderCache::Hit hit() const;
+    bool isAborted() const;
+
+    // Waits for the plugin to free a slot
+    virtual void start();
+    // Called by the plugin once the export may run
+    void run();
+    // Runs in a ThreadWeaver thread
+    void generate();
+    void requestAbort();
+Q_SIGNALS:
+    // Implementations of IStatus signals
+    void clearMessage(KDevelop::IStatus *);
+    void showMessage(KDevelop::IStatus *, const QString &message, int timeout = 0);
+    void hideProgress(KDevelop::IStatus *);
+    void showProgress(KDevelop::IStatus *, int minimum, int maximum, int value);
+    void showErrorMessage(const QString &, int);
+protected:
+    virtual bool doKill();
+private Q_SLOTS:
+    void done(ThreadWeaver::Job *job);
+private:
+    enum ExportType { ExportGraph, ExportFunction, ExportClass, ExportProject };
+
+    void init(const QString &jobName);
+    void generateFunctionControlFlowGraph();
+    void generateClassControlFlowGraph();
+    void generateProjectControlFlowGraph();
+    void generateProjectShard(QList<IndexedDeclaration> roots, QList<IndexedString> files, ControlFlowGraphData *graphData,
+                              ControlFlowGraphEdgeUses *edgeUses, ControlFlowGraphIndex *callGraphIndex);
+    void generateProjectControlFlowGraphFromIndex(ControlFlowGraphTraversal *traversal, const QList<IndexedDeclaration> &roots);
+    void generateProjectControlFlowGraphFromDUChain(ControlFlowGraphTraversal *traversal, const QList<IndexedString> &files);
+    void exportGraph();
+
+    KDevControlFlowGraphViewPlugin *m_plugin;
+    ExportType m_exportType;
+    IndexedDeclaration m_ideclaration;
+    QPointer<IProject> m_project;
+    QList<IndexedString> m_projectFiles;
+    QPointer<ControlFlowGraphIndex> m_callGraphIndex;
+    QStringList m_exportFiles;
+
+    DotControlFlowGraph *m_dotControlFlowGraph;
+    ControlFlowGraphTraversal *m_traversal;
+    QPointer<DUChainControlFlowInternalJob> m_internalJob;
+    ControlFlowGraphRenderCache::Hit m_hit;
+
+    QAtomicInt m_abort;
+    // Traversals of the running project shards, aborted along with the job
+    QMutex m_shardTraversalsMutex;
+    QList<ControlFlowGraphTraversal *> m_shardTraversals;
+    QAtomicInt m_projectProgress;
+    int m_projectProgressMax;
+};
+
+#endif
@@ -19,8 +19,16 @@
 
 #include "controlflowgraphfiledialog.h"
 
+#include <QLabel>
+#include <QRegExp>
+#include <QHBoxLayout>
 #include <QRadioButton>
 
+#include <KLocale>
+#include <KGlobal>
+#include <KLineEdit>
+#include <KConfigGroup>
+
 #include <interfaces/icore.h>
 #include <interfaces/iprojectcontroller.h>
 
@@ -37,6 +45,16 @@ ControlFlowGraphFileDialog::ControlFlowGraphFileDialog(const KUrl& startDir, con
     setConfirmOverwrite(true);
     setMode(KFile::File);
 
+    // Rendered from the same layout as the selected file
+    QWidget *formatsWidget = new QWidget;
+    QHBoxLayout *formatsLayout = new QHBoxLayout(formatsWidget);
+    formatsLayout->setContentsMargins(0, 0, 0, 0);
+    formatsLayout->addWidget(new QLabel(i18n("Also export as:")));
+    m_additionalFormatsLineEdit = new KLineEdit(KConfigGroup(KGlobal::config(), "Control Flow Graph").readEntry("AdditionalExportFormats", QString()));
+    m_additionalFormatsLineEdit->setClickMessage(i18n("Formats, e.g. svg dot"));
+    formatsLayout->addWidget(m_additionalFormatsLineEdit);
+    (dynamic_cast<QBoxLayout *>(mainWidget()->layout()))->insertWidget(1, formatsWidget);
+
     if (mode != NoConfigurationButtons)
     {
         m_configurationWidget = new Ui::ControlFlowGraphExportConfiguration;
@@ -63,6 +81,9 @@ ControlFlowGraphFileDialog::ControlFlowGraphFileDialog(const KUrl& startDir, con
         connect(m_configurationWidget->clusteringProjectCheckBox, SIGNAL(stateChanged(int)), SLOT(setClusteringModes(int)));
 
         connect(m_configurationWidget->limitMaxLevelCheckBox, SIGNAL(stateChanged(int)), SLOT(slotLimitMaxLevelChanged(int)));
+        connect(m_configurationWidget->drawIncomingArcsCheckBox, SIGNAL(stateChanged(int)), SLOT(slotDrawIncomingArcsChanged(int)));
+        connect(m_configurationWidget->layoutEngineComboBox, SIGNAL(currentIndexChanged(int)), SLOT(slotLayoutEngineChanged(int)));
+        connect(m_configurationWidget->nodeBudgetCheckBox, SIGNAL(stateChanged(int)), SLOT(slotNodeBudgetChanged(int)));
 
         if (ICore::self()->projectController()->projectCount() > 0)
         {
@@ -70,15 +91,35 @@ ControlFlowGraphFileDialog::ControlFlowGraphFileDialog(const KUrl& startDir, con
             m_configurationWidget->useFolderNameCheckBox->setEnabled(true);
         }
 
-        (dynamic_cast<QBoxLayout *>(mainWidget()->layout()))->insertWidget(1, widget);
+        (dynamic_cast<QBoxLayout *>(mainWidget()->layout()))->insertWidget(2, widget);
     }
 }
 
 ControlFlowGraphFileDialog::~ControlFlowGraphFileDialog()
 {
+    if (result() == QDialog::Accepted)
+        KConfigGroup(KGlobal::config(), "Control Flow Graph").writeEntry("AdditionalExportFormats", m_additionalFormatsLineEdit->text());
     delete m_configurationWidget;
 }
 
+QStringList ControlFlowGraphFileDialog::exportFiles() const
+{
+    QString fileName = selectedFile();
+    QStringList fileNames(fileName);
+    int extension = fileName.lastIndexOf('.');
+    QString baseName = (extension > fileName.lastIndexOf('/')) ? fileName.left(extension) : fileName;
+
+    foreach (QString format, m_additionalFormatsLineEdit->text().split(QRegExp("[,;\\s]+"), QString::SkipEmptyParts))
+    {
+        if (format.startsWith('.'))
+            format.remove(0, 1);
+        QString additionalFileName = baseName + '.' + format.toLower();
+        if (!format.isEmpty() && !fileNames.contains(additionalFileName))
+            fileNames.append(additionalFileName);
+    }
+    return fileNames;
+}
+
 DUChainControlFlow::ControlFlowMode ControlFlowGraphFileDialog::controlFlowMode() const
 {
     return (m_configurationWidget->controlFlowFunctionRadioButton->isChecked() ?
@@ -125,6 +166,32 @@ bool ControlFlowGraphFileDialog::drawIncomingArcs() const
     return m_configurationWidget->drawIncomingArcsCheckBox->isChecked();
 }
 
+int ControlFlowGraphFileDialog::maxCallerLevel() const
+{
+    return m_configurationWidget->callerLevelSpinBox->value();
+}
+
+DotControlFlowGraph::LayoutEngine ControlFlowGraphFileDialog::layoutEngine() const
+{
+    // Combo box items are in LayoutEngine order
+    return (DotControlFlowGraph::LayoutEngine) m_configurationWidget->layoutEngineComboBox->currentIndex();
+}
+
+int ControlFlowGraphFileDialog::fastLayoutNodes() const
+{
+    return m_configurationWidget->fastLayoutSpinBox->value();
+}
+
+int ControlFlowGraphFileDialog::sfdpLayoutNodes() const
+{
+    return m_configurationWidget->sfdpLayoutSpinBox->value();
+}
+
+int ControlFlowGraphFileDialog::nodeBudget() const
+{
+    return m_configurationWidget->nodeBudgetCheckBox->isChecked() ? m_configurationWidget->nodeBudgetSpinBox->value() : 0;
+}
+
 void ControlFlowGraphFileDialog::setControlFlowMode(bool checked)
 {
     if (checked)
@@ -163,3 +230,18 @@ void ControlFlowGraphFileDialog::slotLimitMaxLevelChanged(int state)
 {
     m_configurationWidget->maxLevelSpinBox->setEnabled((state == Qt::Checked) ? true:false);
 }
+
+void ControlFlowGraphFileDialog::slotDrawIncomingArcsChanged(int state)
+{
+    m_configurationWidget->callerLevelSpinBox->setEnabled((state == Qt::Checked) ? true:false);
+}
+
+void ControlFlowGraphFileDialog::slotLayoutEngineChanged(int index)
+{
+    m_configurationWidget->sfdpLayoutSpinBox->setEnabled(index == DotControlFlowGraph::LayoutBySize);
+}
+
+void ControlFlowGraphFileDialog::slotNodeBudgetChanged(int state)
+{
+    m_configurationWidget->nodeBudgetSpinBox->setEnabled((state == Qt::Checked) ? true:false);
+}
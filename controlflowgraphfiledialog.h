@@ -21,8 +21,12 @@
 #define CONTROLFLOWGRAPHFILEDIALOG_H
 
 #include <KFileDialog>
+#include <QStringList>
 
 #include "duchaincontrolflow.h"
+#include "dotcontrolflowgraph.h"
+
+class KLineEdit;
 
 namespace Ui
 {
@@ -38,18 +42,29 @@ public:
                                QWidget *parent, const QString & caption, OpeningMode mode = ConfigurationButtons);
     ~ControlFlowGraphFileDialog();
     
+    // The selected file, followed by the same file in every additional format
+    QStringList exportFiles() const;
     DUChainControlFlow::ControlFlowMode controlFlowMode() const;
     DUChainControlFlow::ClusteringModes clusteringModes() const;
     int maxLevel() const;
     bool useFolderName() const;
     bool useShortNames() const;
     bool drawIncomingArcs() const;    
+    int maxCallerLevel() const;
+    DotControlFlowGraph::LayoutEngine layoutEngine() const;
+    int fastLayoutNodes() const;
+    int sfdpLayoutNodes() const;
+    int nodeBudget() const;
 public Q_SLOTS:
     void setControlFlowMode(bool);
     void setClusteringModes(int);
     void slotLimitMaxLevelChanged(int state);
+    void slotDrawIncomingArcsChanged(int state);
+    void slotLayoutEngineChanged(int index);
+    void slotNodeBudgetChanged(int state);
 private:
     Ui::ControlFlowGraphExportConfiguration *m_configurationWidget;
+    KLineEdit *m_additionalFormatsLineEdit;
 };
 
 #endif
@@ -0,0 +1,539 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphindex.h"
+
+#include <algorithm>
+
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <KDebug>
+#include <KSaveFile>
+#include <KStandardDirs>
+
+#include <ThreadWeaver/Weaver>
+
+#include <interfaces/icore.h>
+#include <interfaces/iproject.h>
+#include <interfaces/isession.h>
+
+#include <language/duchain/use.h>
+#include <language/duchain/duchain.h>
+#include <language/duchain/declaration.h>
+#include <language/duchain/duchainlock.h>
+#include <language/duchain/topducontext.h>
+#include <language/duchain/types/functiontype.h>
+#include <language/backgroundparser/parsejob.h>
+
+using namespace KDevelop;
+
+namespace {
+    const quint32 INDEX_MAGIC = 0x4b434647; // "KCFG"
+    const quint32 INDEX_VERSION = 2;
+
+    QMutex indexesMutex;
+    QHash<IProject *, ControlFlowGraphIndex *> indexes;
+
+    bool callerLessThan(const ControlFlowGraphIndex::Call &first, const ControlFlowGraphIndex::Call &second)
+    {
+        if (first.callerTop != second.callerTop)
+            return first.callerTop < second.callerTop;
+        if (first.caller != second.caller)
+            return first.caller < second.caller;
+        if (first.calleeTop != second.calleeTop)
+            return first.calleeTop < second.calleeTop;
+        return first.callee < second.callee;
+    }
+
+    bool calleeLessThan(const ControlFlowGraphIndex::Call &first, const ControlFlowGraphIndex::Call &second)
+    {
+        if (first.calleeTop != second.calleeTop)
+            return first.calleeTop < second.calleeTop;
+        return first.callee < second.callee;
+    }
+
+    class ReverseLessThan
+    {
+    public:
+        ReverseLessThan(const QVector<ControlFlowGraphIndex::Call> &calls) : m_calls(calls) {}
+        bool operator()(quint32 first, quint32 second) const
+        {
+            return calleeLessThan(m_calls[first], m_calls[second]);
+        }
+    private:
+        const QVector<ControlFlowGraphIndex::Call> &m_calls;
+    };
+
+    void collectUses(TopDUContext *topContext, DUContext *context, QHash<IndexedDeclaration, quint32> &callees)
+    {
+        const Use *uses = context->uses();
+        int usesCount = context->usesCount();
+        for (int i = 0; i < usesCount; ++i)
+        {
+            Declaration *declaration = topContext->usedDeclarationForIndex(uses[i].m_declarationIndex);
+            if (declaration && declaration->type<KDevelop::FunctionType>())
+                ++callees[IndexedDeclaration(declaration)];
+        }
+        foreach (DUContext *child, context->childContexts())
+            if (child->type() == DUContext::Other)
+                collectUses(topContext, child, callees);
+    }
+
+    void collectCalls(TopDUContext *topContext, DUContext *context, QVector<ControlFlowGraphIndex::Call> &calls)
+    {
+        foreach (Declaration *declaration, context->localDeclarations())
+        {
+            DUContext *internalContext = declaration->internalContext();
+            if (!internalContext)
+                continue;
+
+            if (internalContext->type() == DUContext::Class || internalContext->type() == DUContext::Namespace)
+            {
+                collectCalls(topContext, internalContext, calls);
+                continue;
+            }
+
+            if (!declaration->isDefinition() || !declaration->type<KDevelop::FunctionType>())
+                continue;
+
+            // Function bodies import the arguments context
+            if (internalContext->type() == DUContext::Function && internalContext->importers().size() == 1)
+                internalContext = internalContext->importers()[0];
+            if (internalContext->type() != DUContext::Other)
+                continue;
+
+            QHash<IndexedDeclaration, quint32> callees;
+            collectUses(topContext, internalContext, callees);
+
+            IndexedDeclaration caller(declaration);
+            for (QHash<IndexedDeclaration, quint32>::const_iterator it = callees.constBegin(); it != callees.constEnd(); ++it)
+            {
+                ControlFlowGraphIndex::Call call = { caller.topContextIndex(), caller.localIndex(), it.key().topContextIndex(), it.key().localIndex(), it.value() };
+                calls.append(call);
+            }
+        }
+    }
+
+    class ControlFlowGraphIndexJob : public ThreadWeaver::Job
+    {
+    public:
+        ControlFlowGraphIndexJob(ControlFlowGraphIndex *index) : m_index(index) {}
+        virtual int priority() const { return -1; }
+        virtual void requestAbort() { m_index->requestAbort(); }
+    protected:
+        virtual void run() { m_index->indexPendingFiles(); }
+    private:
+        ControlFlowGraphIndex *m_index;
+    };
+}
+
+ControlFlowGraphIndex::ControlFlowGraphIndex(IProject *project, QObject *parent)
+ : QObject(parent),
+   m_project(project),
+   m_mapped(0),
+   m_mappedCalls(0),
+   m_mappedReverse(0),
+   m_mappedCallCount(0),
+   m_dirty(false),
+   m_abort(false),
+   m_indexing(false)
+{
+    m_fileName = KStandardDirs::locateLocal("data", "kdevcontrolflowgraph/" + ICore::self()->activeSession()->id().toString() + '/' + project->name() + ".index", true);
+    load();
+
+    m_indexTimer.setSingleShot(true);
+    m_indexTimer.setInterval(5000);
+    connect(&m_indexTimer, SIGNAL(timeout()), SLOT(startIndexing()));
+
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(30000);
+    connect(&m_saveTimer, SIGNAL(timeout()), SLOT(save()));
+
+    // Files changed while the session was closed get reparsed, everything else still matches the DUChain
+    updateProjectFiles();
+
+    QMutexLocker locker(&indexesMutex);
+    indexes.insert(project, this);
+}
+
+ControlFlowGraphIndex::~ControlFlowGraphIndex()
+{
+    {
+        QMutexLocker locker(&indexesMutex);
+        indexes.remove(indexes.key(this));
+    }
+
+    requestAbort();
+    if (m_indexJob && ThreadWeaver::Weaver::instance()->dequeue(m_indexJob))
+        delete m_indexJob;
+    else
+    {
+        // The job is already running, wait until the weaver is done with it. It deletes itself later
+        QMutexLocker locker(&m_indexingMutex);
+        while (m_indexing)
+            m_indexingDone.wait(&m_indexingMutex);
+    }
+
+    save();
+    unmap();
+}
+
+ControlFlowGraphIndex *ControlFlowGraphIndex::forProject(IProject *project)
+{
+    QMutexLocker locker(&indexesMutex);
+    return indexes.value(project);
+}
+
+IProject *ControlFlowGraphIndex::project() const
+{
+    return m_project;
+}
+
+bool ControlFlowGraphIndex::isComplete()
+{
+    {
+        QMutexLocker locker(&m_indexingMutex);
+        if (m_indexing)
+            return false;
+    }
+
+    QReadLocker lock(&m_lock);
+    if (!m_pendingFiles.isEmpty() || m_projectFiles.isEmpty())
+        return false;
+
+    // Files never indexed are queued by updateProjectFiles()
+    foreach (const IndexedString &file, m_projectFiles)
+        if (!m_fileTops.contains(file.index()))
+            return false;
+    return true;
+}
+
+void ControlFlowGraphIndex::updateProjectFiles()
+{
+    if (!m_project)
+        return;
+
+    QSet<IndexedString> files = m_project->fileSet();
+    bool pending;
+    {
+        QWriteLocker lock(&m_lock);
+        m_projectFiles = files;
+        foreach (const IndexedString &file, files)
+            if (!m_fileTops.contains(file.index()))
+                m_pendingFiles.insert(file);
+        pending = !m_pendingFiles.isEmpty();
+    }
+
+    if (pending && !m_indexTimer.isActive())
+        m_indexTimer.start();
+}
+
+bool ControlFlowGraphIndex::containsTopContext(uint topContext) const
+{
+    QReadLocker lock(&m_lock);
+    return m_tops.contains(topContext);
+}
+
+QList<QPair<IndexedDeclaration, int> > ControlFlowGraphIndex::callees(const IndexedDeclaration &caller) const
+{
+    QReadLocker lock(&m_lock);
+
+    Call key = { caller.topContextIndex(), caller.localIndex(), 0, 0, 0 };
+    const Call *begin = m_mappedCalls;
+    const Call *end = m_mappedCalls + m_mappedCallCount;
+
+    QHash<quint32, QVector<Call> >::const_iterator updated = m_updatedCalls.constFind(key.callerTop);
+    if (updated != m_updatedCalls.constEnd())
+    {
+        begin = updated->constData();
+        end = begin + updated->size();
+    }
+
+    QList<QPair<IndexedDeclaration, int> > result;
+    for (const Call *it = std::lower_bound(begin, end, key, callerLessThan);
+         it != end && it->callerTop == key.callerTop && it->caller == key.caller; ++it)
+        result << qMakePair(IndexedDeclaration(it->calleeTop, it->callee), int(it->uses));
+    return result;
+}
+
+QList<QPair<IndexedDeclaration, int> > ControlFlowGraphIndex::callers(const IndexedDeclaration &callee) const
+{
+    QReadLocker lock(&m_lock);
+
+    Call key = { 0, 0, callee.topContextIndex(), callee.localIndex(), 0 };
+    QList<QPair<IndexedDeclaration, int> > result;
+
+    // Binary search the reverse table for the first call of callee
+    quint32 first = 0, last = m_mappedCallCount;
+    while (first < last)
+    {
+        quint32 middle = first + (last - first) / 2;
+        if (calleeLessThan(m_mappedCalls[m_mappedReverse[middle]], key))
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    for (; first < m_mappedCallCount; ++first)
+    {
+        const Call &call = m_mappedCalls[m_mappedReverse[first]];
+        if (call.calleeTop != key.calleeTop || call.callee != key.callee)
+            break;
+        if (!m_updatedCalls.contains(call.callerTop))
+            result << qMakePair(IndexedDeclaration(call.callerTop, call.caller), int(call.uses));
+    }
+
+    foreach (const QVector<Call> &calls, m_updatedCalls)
+        foreach (const Call &call, calls)
+            if (call.calleeTop == key.calleeTop && call.callee == key.callee)
+                result << qMakePair(IndexedDeclaration(call.callerTop, call.caller), int(call.uses));
+
+    return result;
+}
+
+QList<IndexedDeclaration> ControlFlowGraphIndex::allCallers() const
+{
+    QReadLocker lock(&m_lock);
+
+    QList<IndexedDeclaration> result;
+    const Call *previous = 0;
+    for (const Call *it = m_mappedCalls; it != m_mappedCalls + m_mappedCallCount; previous = it++)
+        if (!m_updatedCalls.contains(it->callerTop) &&
+            (!previous || previous->callerTop != it->callerTop || previous->caller != it->caller))
+            result << IndexedDeclaration(it->callerTop, it->caller);
+
+    foreach (const QVector<Call> &calls, m_updatedCalls)
+        for (int i = 0; i < calls.size(); ++i)
+            if (i == 0 || calls[i-1].caller != calls[i].caller)
+                result << IndexedDeclaration(calls[i].callerTop, calls[i].caller);
+
+    return result;
+}
+
+void ControlFlowGraphIndex::indexPendingFiles()
+{
+    QSet<IndexedString> files;
+    {
+        QWriteLocker lock(&m_lock);
+        files = m_pendingFiles;
+        m_pendingFiles.clear();
+    }
+
+    foreach (const IndexedString &file, files)
+    {
+        if (m_abort)
+        {
+            QWriteLocker lock(&m_lock);
+            m_pendingFiles.insert(file);
+            continue;
+        }
+
+        QVector<Call> calls;
+        quint32 top = 0;
+        {
+            // One lock window per file, so the background parser is never blocked for long
+            DUChainReadLocker lock(DUChain::lock());
+            TopDUContext *topContext = DUChain::self()->chainForDocument(file);
+            if (topContext)
+            {
+                top = topContext->ownIndex();
+                collectCalls(topContext, topContext, calls);
+            }
+        }
+        std::sort(calls.begin(), calls.end(), callerLessThan);
+        replaceCalls(file, top, calls);
+    }
+}
+
+void ControlFlowGraphIndex::requestAbort()
+{
+    m_abort = true;
+}
+
+void ControlFlowGraphIndex::parseJobFinished(KDevelop::ParseJob *parseJob)
+{
+    if (!m_project)
+        return;
+
+    if (!m_project->inProject(KUrl(parseJob->document().str())))
+        return;
+
+    {
+        // Files added to the project are known to isComplete() once they are parsed
+        QWriteLocker lock(&m_lock);
+        m_projectFiles.insert(parseJob->document());
+        m_pendingFiles.insert(parseJob->document());
+    }
+    // Throttled: a burst of parse jobs results in a single indexing run
+    if (!m_indexTimer.isActive())
+        m_indexTimer.start();
+}
+
+void ControlFlowGraphIndex::save()
+{
+    QWriteLocker lock(&m_lock);
+    if (!m_dirty)
+        return;
+
+    QVector<Call> calls;
+    for (const Call *it = m_mappedCalls; it != m_mappedCalls + m_mappedCallCount; ++it)
+        if (!m_updatedCalls.contains(it->callerTop))
+            calls.append(*it);
+    foreach (const QVector<Call> &updatedCalls, m_updatedCalls)
+        calls += updatedCalls;
+    std::sort(calls.begin(), calls.end(), callerLessThan);
+
+    QVector<quint32> reverse(calls.size());
+    for (int i = 0; i < reverse.size(); ++i)
+        reverse[i] = i;
+    std::stable_sort(reverse.begin(), reverse.end(), ReverseLessThan(calls));
+
+    QVector<FileEntry> files;
+    for (QHash<quint32, quint32>::const_iterator it = m_fileTops.constBegin(); it != m_fileTops.constEnd(); ++it)
+    {
+        FileEntry entry = { it.key(), it.value() };
+        files.append(entry);
+    }
+
+    KSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        kDebug() << "Could not save control flow graph index" << m_fileName;
+        return;
+    }
+    Header header = { INDEX_MAGIC, INDEX_VERSION, quint32(files.size()), quint32(calls.size()) };
+    file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    file.write(reinterpret_cast<const char *>(files.constData()), files.size() * sizeof(FileEntry));
+    file.write(reinterpret_cast<const char *>(calls.constData()), calls.size() * sizeof(Call));
+    file.write(reinterpret_cast<const char *>(reverse.constData()), reverse.size() * sizeof(quint32));
+    if (!file.finalize())
+    {
+        kDebug() << "Could not save control flow graph index" << m_fileName;
+        return;
+    }
+
+    m_updatedCalls.clear();
+    m_dirty = false;
+    unmap();
+    load();
+}
+
+void ControlFlowGraphIndex::startIndexing()
+{
+    {
+        QMutexLocker locker(&m_indexingMutex);
+        if (m_indexing)
+        {
+            m_indexTimer.start();
+            return;
+        }
+        m_indexing = true;
+    }
+
+    m_abort = false;
+    m_indexJob = new ControlFlowGraphIndexJob(this);
+    // Direct, so the destructor can wait for it even when the GUI thread is blocked in it
+    connect(m_indexJob, SIGNAL(done(ThreadWeaver::Job*)), SLOT(indexJobFinished()), Qt::DirectConnection);
+    connect(m_indexJob, SIGNAL(done(ThreadWeaver::Job*)), SLOT(indexingDone()));
+    // Also deletes jobs outliving this
+    connect(m_indexJob, SIGNAL(done(ThreadWeaver::Job*)), m_indexJob, SLOT(deleteLater()));
+    ThreadWeaver::Weaver::instance()->enqueue(m_indexJob);
+}
+
+void ControlFlowGraphIndex::indexJobFinished()
+{
+    QMutexLocker locker(&m_indexingMutex);
+    m_indexing = false;
+    m_indexingDone.wakeAll();
+}
+
+void ControlFlowGraphIndex::indexingDone()
+{
+    QReadLocker lock(&m_lock);
+    if (!m_pendingFiles.isEmpty() && !m_indexTimer.isActive())
+        m_indexTimer.start();
+    if (m_dirty && !m_saveTimer.isActive())
+        m_saveTimer.start();
+}
+
+void ControlFlowGraphIndex::load()
+{
+    m_file.setFileName(m_fileName);
+    if (!m_file.exists() || !m_file.open(QIODevice::ReadOnly))
+        return;
+
+    qint64 size = m_file.size();
+    if (size >= qint64(sizeof(Header)))
+        m_mapped = m_file.map(0, size);
+
+    const Header *header = reinterpret_cast<const Header *>(m_mapped);
+    if (!m_mapped || header->magic != INDEX_MAGIC || header->version != INDEX_VERSION ||
+        size != qint64(sizeof(Header) + header->fileCount * sizeof(FileEntry) + header->callCount * (sizeof(Call) + sizeof(quint32))))
+    {
+        kDebug() << "Discarding invalid control flow graph index" << m_fileName;
+        unmap();
+        m_file.remove();
+        return;
+    }
+
+    const FileEntry *files = reinterpret_cast<const FileEntry *>(m_mapped + sizeof(Header));
+    m_fileTops.clear();
+    m_tops.clear();
+    for (quint32 i = 0; i < header->fileCount; ++i)
+    {
+        m_fileTops.insert(files[i].file, files[i].top);
+        m_tops.insert(files[i].top);
+    }
+
+    m_mappedCallCount = header->callCount;
+    m_mappedCalls = reinterpret_cast<const Call *>(files + header->fileCount);
+    m_mappedReverse = reinterpret_cast<const quint32 *>(m_mappedCalls + m_mappedCallCount);
+}
+
+void ControlFlowGraphIndex::unmap()
+{
+    if (m_mapped)
+        m_file.unmap(m_mapped);
+    m_file.close();
+    m_mapped = 0;
+    m_mappedCalls = 0;
+    m_mappedReverse = 0;
+    m_mappedCallCount = 0;
+}
+
+void ControlFlowGraphIndex::replaceCalls(const IndexedString &file, quint32 top, const QVector<Call> &calls)
+{
+    QWriteLocker lock(&m_lock);
+
+    // A reparse may have put the file in a new top context, drop the calls of the old one
+    QHash<quint32, quint32>::const_iterator previous = m_fileTops.constFind(file.index());
+    if (previous != m_fileTops.constEnd() && *previous != top && *previous != 0)
+    {
+        m_updatedCalls[*previous] = QVector<Call>();
+        m_tops.remove(*previous);
+    }
+
+    if (top)
+    {
+        m_updatedCalls[top] = calls;
+        m_tops.insert(top);
+    }
+    m_fileTops[file.index()] = top;
+    m_dirty = true;
+}
@@ -0,0 +1,140 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHINDEX_H
+#define CONTROLFLOWGRAPHINDEX_H
+
+#include <QFile>
+#include <QSet>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QTimer>
+#include <QVector>
+#include <QPointer>
+#include <QAtomicInt>
+#include <QWaitCondition>
+#include <QReadWriteLock>
+
+#include <ThreadWeaver/Job>
+
+#include <language/duchain/ducontext.h>
+#include <language/duchain/indexedstring.h>
+
+namespace KDevelop
+{
+    class IProject;
+    class ParseJob;
+}
+
+using namespace KDevelop;
+
+// Persistent caller -> callee index of a project, stored in a memory-mapped file in the session
+// data directory. It is kept up to date in the background from parse job notifications, so
+// project exports and incoming arcs don't need to re-walk every function body in the DUChain.
+class ControlFlowGraphIndex : public QObject
+{
+    Q_OBJECT
+public:
+    struct Call
+    {
+        quint32 callerTop;
+        quint32 caller;
+        quint32 calleeTop;
+        quint32 callee;
+        quint32 uses; // Call sites of callee in the caller body
+    };
+
+    explicit ControlFlowGraphIndex(IProject *project, QObject *parent = 0);
+    virtual ~ControlFlowGraphIndex();
+
+    static ControlFlowGraphIndex *forProject(IProject *project);
+
+    IProject *project() const;
+    // True when every file of the project has been indexed and no update is pending. Safe from
+    // any thread, the project files are only read from the GUI thread
+    bool isComplete();
+    // Reads the project files again and queues the ones never indexed. GUI thread only
+    void updateProjectFiles();
+    bool containsTopContext(uint topContext) const;
+
+    // Each with its number of call sites
+    QList<QPair<IndexedDeclaration, int> > callees(const IndexedDeclaration &caller) const;
+    QList<QPair<IndexedDeclaration, int> > callers(const IndexedDeclaration &callee) const;
+    QList<IndexedDeclaration> allCallers() const;
+
+    // Called from the background job
+    void indexPendingFiles();
+    void requestAbort();
+public Q_SLOTS:
+    void parseJobFinished(KDevelop::ParseJob *parseJob);
+    void save();
+private Q_SLOTS:
+    void startIndexing();
+    // Called on the weaver thread once it is done with the job
+    void indexJobFinished();
+    void indexingDone();
+private:
+    struct Header
+    {
+        quint32 magic;
+        quint32 version;
+        quint32 fileCount;
+        quint32 callCount;
+    };
+    struct FileEntry
+    {
+        quint32 file;
+        quint32 top;
+    };
+
+    void load();
+    void unmap();
+    void replaceCalls(const IndexedString &file, quint32 top, const QVector<Call> &calls);
+
+    QPointer<IProject> m_project;
+    QString m_fileName;
+
+    QFile m_file;
+    uchar *m_mapped;
+    const Call *m_mappedCalls;
+    const quint32 *m_mappedReverse;
+    quint32 m_mappedCallCount;
+
+    // Calls indexed since the file was last mapped, by caller top context
+    QHash<quint32, QVector<Call> > m_updatedCalls;
+    QHash<quint32, quint32> m_fileTops;
+    QSet<quint32> m_tops;
+    QSet<IndexedString> m_pendingFiles;
+    // Project files as last read from the GUI thread
+    QSet<IndexedString> m_projectFiles;
+    bool m_dirty;
+    QAtomicInt m_abort;
+    mutable QReadWriteLock m_lock;
+
+    bool m_indexing;
+    QMutex m_indexingMutex;
+    QWaitCondition m_indexingDone;
+
+    QTimer m_indexTimer;
+    QTimer m_saveTimer;
+    QPointer<ThreadWeaver::Job> m_indexJob;
+};
+
+#endif
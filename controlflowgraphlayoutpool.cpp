@@ -0,0 +1,154 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphlayoutpool.h"
+
+#include <sys/resource.h>
+
+#include <QThread>
+#include <QProcess>
+#include <QElapsedTimer>
+
+#include <KDebug>
+#include <KGlobal>
+#include <KConfigGroup>
+#include <KStandardDirs>
+
+namespace {
+    static const char DOT[] = "dot";
+    static const char NEATO[] = "neato";
+    static const char FDP[] = "fdp";
+    static const char SFDP[] = "sfdp";
+    static const char NOP2[] = "nop2";
+    // Granularity of the timeout and cancellation checks, in milliseconds
+    const int POLL_INTERVAL = 100;
+
+    // Limits the address space of the worker, so a huge layout fails instead of swapping
+    class LimitedProcess : public QProcess
+    {
+    public:
+        LimitedProcess(qint64 memoryLimit) : m_memoryLimit(memoryLimit) { }
+    protected:
+        virtual void setupChildProcess()
+        {
+            if (m_memoryLimit > 0)
+            {
+                struct rlimit limit;
+                limit.rlim_cur = limit.rlim_max = m_memoryLimit;
+                setrlimit(RLIMIT_AS, &limit);
+            }
+        }
+    private:
+        qint64 m_memoryLimit;
+    };
+}
+
+K_GLOBAL_STATIC(ControlFlowGraphLayoutPool, s_layoutPool)
+
+ControlFlowGraphLayoutPool::ControlFlowGraphLayoutPool()
+{
+    KConfigGroup group(KGlobal::config(), "Control Flow Graph");
+    m_workers.release(qMax(1, group.readEntry("LayoutWorkers", QThread::idealThreadCount())));
+    m_timeout = group.readEntry("LayoutTimeout", 60) * 1000;
+    m_memoryLimit = group.readEntry("LayoutMemoryLimit", 1024) * Q_INT64_C(1024) * 1024;
+
+    m_program = KStandardDirs::findExe(DOT);
+    if (m_program.isEmpty())
+        kWarning() << "Graphviz dot executable not found, control flow graphs cannot be laid out";
+}
+
+ControlFlowGraphLayoutPool *ControlFlowGraphLayoutPool::self()
+{
+    return s_layoutPool;
+}
+
+bool ControlFlowGraphLayoutPool::isAvailable() const
+{
+    return !m_program.isEmpty();
+}
+
+QByteArray ControlFlowGraphLayoutPool::layout(const QByteArray &source, const char *engine, const QAtomicInt *cancelled)
+{
+    QByteArray output;
+    for (; engine; engine = cheaperEngine(engine))
+    {
+        if (run(QStringList() << QString("-K") + engine << "-Tdot", source, &output, cancelled))
+            return output;
+        if (cancelled && *cancelled)
+            break;
+        kDebug() << "Layout with" << engine << "failed";
+    }
+    return QByteArray();
+}
+
+bool ControlFlowGraphLayoutPool::render(const QByteArray &layout, const QStringList &fileNames)
+{
+    // A single worker renders every format, positions are taken from the layout
+    QStringList arguments(QString("-K") + NOP2);
+    foreach (const QString &fileName, fileNames)
+        arguments << "-T" + fileName.mid(fileName.lastIndexOf('.') + 1) << "-o" + fileName;
+    QByteArray output;
+    return run(arguments, layout, &output, 0);
+}
+
+const char *ControlFlowGraphLayoutPool::cheaperEngine(const char *engine)
+{
+    // neato skips ranking and crossing minimization, sfdp is multilevel and scales to huge graphs
+    if (qstrcmp(engine, DOT) == 0 || qstrcmp(engine, FDP) == 0)
+        return NEATO;
+    if (qstrcmp(engine, NEATO) == 0)
+        return SFDP;
+    return 0;
+}
+
+bool ControlFlowGraphLayoutPool::run(const QStringList &arguments, const QByteArray &input, QByteArray *output, const QAtomicInt *cancelled)
+{
+    if (m_program.isEmpty())
+        return false;
+
+    m_workers.acquire();
+    LimitedProcess process(m_memoryLimit);
+    process.start(m_program, arguments);
+    bool finished = false;
+    if (process.waitForStarted())
+    {
+        process.write(input);
+        process.closeWriteChannel();
+
+        QElapsedTimer timer;
+        timer.start();
+        while (!(finished = process.waitForFinished(POLL_INTERVAL)) && process.state() != QProcess::NotRunning)
+        {
+            if ((cancelled && *cancelled) || timer.elapsed() > m_timeout)
+            {
+                kDebug() << "Killing" << arguments << "after" << timer.elapsed() << "ms";
+                process.kill();
+                process.waitForFinished();
+                break;
+            }
+        }
+    }
+    m_workers.release();
+
+    // Exceeding the memory limit aborts the worker
+    if (!finished || process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+        return false;
+    *output = process.readAllStandardOutput();
+    return true;
+}
@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHLAYOUTPOOL_H
+#define CONTROLFLOWGRAPHLAYOUTPOOL_H
+
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QStringList>
+#include <QByteArray>
+
+// Runs graphviz in helper processes, fed with dot source on their standard input. Layouts of
+// several views and exports run in parallel, at most one per worker, and a runaway one can neither
+// freeze nor exhaust the IDE: jobs beyond their time or memory limit are killed and retried with a
+// cheaper engine.
+class ControlFlowGraphLayoutPool
+{
+public:
+    // Worker count and limits are read from the "Control Flow Graph" configuration group
+    ControlFlowGraphLayoutPool();
+
+    // Shared by every graph of the process
+    static ControlFlowGraphLayoutPool *self();
+
+    // False if no graphviz executable was found
+    bool isAvailable() const;
+    // Lays source out, returning it in dot format with positions, or an empty array if every
+    // engine failed. Blocks the calling thread, cancelled as soon as *cancelled is set
+    QByteArray layout(const QByteArray &source, const char *engine, const QAtomicInt *cancelled = 0);
+    // Renders a laid out graph to every file, in the format given by its extension
+    bool render(const QByteArray &layout, const QStringList &fileNames);
+private:
+    static const char *cheaperEngine(const char *engine);
+    bool run(const QStringList &arguments, const QByteArray &input, QByteArray *output, const QAtomicInt *cancelled);
+
+    QString m_program;
+    QSemaphore m_workers;
+    int m_timeout;
+    qint64 m_memoryLimit;
+};
+
+#endif
@@ -0,0 +1,222 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphlayoutthread.h"
+
+#include <QMutexLocker>
+
+#include <KDebug>
+
+#include "dotcontrolflowgraph.h"
+#include "controlflowgraphlayoutpool.h"
+
+namespace {
+    static char DOT[] = "dot";
+    static char NEATO[] = "neato";
+    static char POS[] = "pos";
+    static char INPUTSCALE[] = "inputscale";
+    static char POINTS[] = "72";
+    static char EMPTY[] = "";
+}
+
+ControlFlowGraphLayoutThread::ControlFlowGraphLayoutThread(DotControlFlowGraph *dotControlFlowGraph)
+: m_dotControlFlowGraph(dotControlFlowGraph),
+  m_hasQueuedGraph(false),
+  m_generation(0),
+  m_readyGraph(0),
+  m_readyGeneration(0),
+  m_stop(false),
+  m_cancelled(0)
+{
+}
+
+ControlFlowGraphLayoutThread::~ControlFlowGraphLayoutThread()
+{
+    stop();
+    if (m_readyGraph)
+        DotControlFlowGraph::closeGraph(m_readyGraph);
+}
+
+int ControlFlowGraphLayoutThread::layout(const ControlFlowGraphData &graphData, const QSet<int> &expandedClusters)
+{
+    QMutexLocker locker(&m_mutex);
+    m_queuedGraph = graphData;
+    m_queuedExpandedClusters = expandedClusters;
+    m_hasQueuedGraph = true;
+    ++m_generation;
+    if (!isRunning())
+        start(QThread::LowPriority);
+    m_condition.wakeOne();
+    return m_generation;
+}
+
+Agraph_t *ControlFlowGraphLayoutThread::takeLayout(int *generation, QByteArray *layout)
+{
+    QMutexLocker locker(&m_mutex);
+    Agraph_t *readyGraph = m_readyGraph;
+    m_readyGraph = 0;
+    if (generation)
+        *generation = m_readyGeneration;
+    if (layout)
+        *layout = m_readyLayout;
+    m_readyLayout.clear();
+    return readyGraph;
+}
+
+int ControlFlowGraphLayoutThread::generation()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_generation;
+}
+
+int ControlFlowGraphLayoutThread::skipLayout()
+{
+    QMutexLocker locker(&m_mutex);
+    m_queuedGraph.clear();
+    m_queuedExpandedClusters.clear();
+    m_hasQueuedGraph = false;
+    return ++m_generation;
+}
+
+void ControlFlowGraphLayoutThread::stop()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stop = true;
+        m_cancelled = 1;
+        m_condition.wakeOne();
+    }
+    wait();
+}
+
+void ControlFlowGraphLayoutThread::run()
+{
+    forever
+    {
+        ControlFlowGraphData graphData;
+        QSet<int> expandedClusters;
+        int generation;
+        {
+            QMutexLocker locker(&m_mutex);
+            while (!m_hasQueuedGraph && !m_stop)
+                m_condition.wait(&m_mutex);
+            if (m_stop)
+                break;
+            graphData = m_queuedGraph;
+            expandedClusters = m_queuedExpandedClusters;
+            generation = m_generation;
+            m_queuedGraph.clear();
+            m_hasQueuedGraph = false;
+        }
+
+        char *engine = m_dotControlFlowGraph->layoutEngine(graphData);
+        QByteArray source;
+        {
+            QMutexLocker locker(&DotControlFlowGraph::mutex);
+            Agraph_t *rootGraph = m_dotControlFlowGraph->buildGraph(graphData, expandedClusters);
+            engine = seedPositions(graphData, rootGraph, engine);
+            source = DotControlFlowGraph::writeGraph(rootGraph);
+            agclose(rootGraph);
+        }
+
+        // Positions are kept as attributes, so the view does not lay the graph out again
+        QByteArray layout = ControlFlowGraphLayoutPool::self()->layout(source, engine, &m_cancelled);
+        Agraph_t *rootGraph = layout.isEmpty() ? 0 : DotControlFlowGraph::readGraph(layout);
+        if (!rootGraph)
+        {
+            kWarning() << "Control flow graph could not be laid out";
+            continue;
+        }
+        {
+            QMutexLocker locker(&DotControlFlowGraph::mutex);
+            storePositions(graphData, rootGraph);
+        }
+
+        Agraph_t *replacedGraph;
+        {
+            QMutexLocker locker(&m_mutex);
+            replacedGraph = m_readyGraph;
+            m_readyGraph = rootGraph;
+            m_readyLayout = layout;
+            m_readyGeneration = generation;
+        }
+
+        // A replaced layout was never taken, its layoutReady() is still pending
+        if (replacedGraph)
+            DotControlFlowGraph::closeGraph(replacedGraph);
+        else
+            emit layoutReady();
+    }
+}
+
+char *ControlFlowGraphLayoutThread::seedPositions(const ControlFlowGraphData &graphData, Agraph_t *rootGraph, char *engine)
+{
+    // Only neato keeps pinned positions. Graphs dot would draw go through it once most of their nodes were drawn
+    // before, sfdp graphs and graphs mostly made of new nodes are laid out from scratch
+    const QVector<ControlFlowGraphData::Node> &nodes = graphData.nodes();
+    if (m_positions.isEmpty() || (qstrcmp(engine, DOT) != 0 && qstrcmp(engine, NEATO) != 0))
+        return engine;
+
+    QVector<QByteArray> positions(nodes.size());
+    int surviving = 0;
+    for (int i = 0; i < nodes.size(); ++i)
+    {
+        QHash<NodeIdentity, QByteArray>::const_iterator position = m_positions.constFind(qMakePair(nodes[i].key, nodes[i].label));
+        if (position != m_positions.constEnd())
+        {
+            positions[i] = *position;
+            ++surviving;
+        }
+    }
+    if (surviving == 0 || 2 * surviving < nodes.size())
+        return engine;
+
+    // Surviving nodes are pinned where they were drawn, neato only places the new ones around them
+    agsafeset(rootGraph, INPUTSCALE, POINTS, EMPTY);
+    for (int i = 0; i < nodes.size(); ++i)
+        if (!positions[i].isEmpty())
+        {
+            Agnode_t *node = agnode(rootGraph, ControlFlowGraphData::nodeName(i).toUtf8().data(), 0);
+            QByteArray pinnedPosition = positions[i] + '!';
+            if (node)
+                agsafeset(node, POS, pinnedPosition.data(), EMPTY);
+        }
+    return NEATO;
+}
+
+void ControlFlowGraphLayoutThread::storePositions(const ControlFlowGraphData &graphData, Agraph_t *rootGraph)
+{
+    // An empty graph is shown between two functions, it must not forget the previous positions
+    const QVector<ControlFlowGraphData::Node> &nodes = graphData.nodes();
+    if (nodes.isEmpty())
+        return;
+
+    m_positions.clear();
+    for (int i = 0; i < nodes.size(); ++i)
+    {
+        Agnode_t *node = agnode(rootGraph, ControlFlowGraphData::nodeName(i).toUtf8().data(), 0);
+        if (!node)
+            continue;
+        QByteArray position(agget(node, POS));
+        if (position.endsWith('!'))
+            position.chop(1);
+        if (!position.isEmpty())
+            m_positions.insert(qMakePair(nodes[i].key, nodes[i].label), position);
+    }
+}
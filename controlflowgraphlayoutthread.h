@@ -0,0 +1,84 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHLAYOUTTHREAD_H
+#define CONTROLFLOWGRAPHLAYOUTTHREAD_H
+
+#include <QSet>
+#include <QHash>
+#include <QPair>
+#include <QMutex>
+#include <QThread>
+#include <QAtomicInt>
+#include <QWaitCondition>
+
+#include <graphviz/cgraph.h>
+
+#include "controlflowgraphdata.h"
+
+class DotControlFlowGraph;
+
+// Lays out the graphs shown in the tool view, off both the GUI and the traversal threads.
+// Only the newest queued snapshot is laid out, and only the newest finished layout is kept.
+class ControlFlowGraphLayoutThread : public QThread
+{
+    Q_OBJECT
+public:
+    ControlFlowGraphLayoutThread(DotControlFlowGraph *dotControlFlowGraph);
+    virtual ~ControlFlowGraphLayoutThread();
+
+    // Returns the generation of the queued snapshot, replacing one not laid out yet
+    int layout(const ControlFlowGraphData &graphData, const QSet<int> &expandedClusters);
+    // Newest finished layout not taken yet, or 0. The caller closes it
+    Agraph_t *takeLayout(int *generation = 0, QByteArray *layout = 0);
+    // Generation of the last queued snapshot
+    int generation();
+    // Drops the queued snapshot for a layout made earlier, returns the generation to show it as
+    int skipLayout();
+    void stop();
+Q_SIGNALS:
+    void layoutReady();
+protected:
+    virtual void run();
+private:
+    typedef QPair<IndexedDeclaration, QString> NodeIdentity;
+    // Pins the nodes drawn by the previous layout, returns the engine to lay graphData out with
+    char *seedPositions(const ControlFlowGraphData &graphData, Agraph_t *rootGraph, char *engine);
+    void storePositions(const ControlFlowGraphData &graphData, Agraph_t *rootGraph);
+
+    DotControlFlowGraph *m_dotControlFlowGraph;
+    // Node positions of the last layout, only used by the layout thread
+    QHash<NodeIdentity, QByteArray> m_positions;
+
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    ControlFlowGraphData m_queuedGraph;
+    QSet<int> m_queuedExpandedClusters;
+    bool m_hasQueuedGraph;
+    int m_generation;
+    // Back buffer, the front one is the graph the view has loaded
+    Agraph_t *m_readyGraph;
+    QByteArray m_readyLayout;
+    int m_readyGeneration;
+    bool m_stop;
+    // Set with m_stop, read by the worker pool without locking
+    QAtomicInt m_cancelled;
+};
+
+#endif
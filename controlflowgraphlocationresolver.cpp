@@ -0,0 +1,174 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphlocationresolver.h"
+
+#include <KUrl>
+
+#include <interfaces/icore.h>
+#include <interfaces/iproject.h>
+#include <interfaces/iprojectcontroller.h>
+
+#include <project/projectmodel.h>
+#include <project/interfaces/ibuildsystemmanager.h>
+#include <util/path.h>
+
+using namespace KDevelop;
+
+ControlFlowGraphLocationResolver::ControlFlowGraphLocationResolver(QObject *parent)
+: QObject(parent)
+{
+    IProjectController *projectController = ICore::self()->projectController();
+    connect(projectController, SIGNAL(projectOpened(KDevelop::IProject*)), SLOT(invalidate()));
+    connect(projectController, SIGNAL(projectClosed(KDevelop::IProject*)), SLOT(invalidate()));
+    connect(projectController, SIGNAL(projectConfigurationChanged(KDevelop::IProject*)), SLOT(invalidateProject(KDevelop::IProject*)));
+}
+
+ControlFlowGraphLocationResolver::~ControlFlowGraphLocationResolver()
+{
+}
+
+void ControlFlowGraphLocationResolver::prepareProject(IProject *project)
+{
+    if (!project)
+        return;
+
+    {
+        QReadLocker locker(&m_lock);
+        if (m_includeTries.contains(project))
+            return;
+    }
+
+    IncludeTrie trie(1);
+    trie[0].includeDirectory = false;
+
+    KDevelop::ProjectBaseItem *projectItem = project->projectItem();
+    IBuildSystemManager *buildSystemManager = 0;
+    if (projectItem && (buildSystemManager = project->buildSystemManager()))
+    {
+        foreach (const Path &includeDirectory, buildSystemManager->includeDirectories(projectItem))
+        {
+            int node = 0;
+            foreach (const QString &segment, includeDirectory.toLocalFile().split('/', QString::SkipEmptyParts))
+            {
+                int child = trie[node].children.value(segment, -1);
+                if (child == -1)
+                {
+                    child = trie.size();
+                    trie[node].children.insert(segment, child);
+                    TrieNode childNode;
+                    childNode.includeDirectory = false;
+                    trie.append(childNode);
+                }
+                node = child;
+            }
+            trie[node].includeDirectory = true;
+        }
+    }
+
+    QWriteLocker locker(&m_lock);
+    m_includeTries.insert(project, trie);
+    // Answers given before the project was prepared knew no include directory
+    removeFolderNamespaces(project);
+}
+
+IProject *ControlFlowGraphLocationResolver::projectForUrl(const IndexedString &url)
+{
+    {
+        QReadLocker locker(&m_lock);
+        QHash<uint, IProject *>::const_iterator it = m_projects.constFind(url.index());
+        if (it != m_projects.constEnd())
+            return *it;
+    }
+
+    IProject *project = ICore::self()->projectController()->findProjectForUrl(KUrl(url.str()));
+
+    QWriteLocker locker(&m_lock);
+    m_projects.insert(url.index(), project);
+    return project;
+}
+
+QString ControlFlowGraphLocationResolver::folderNamespace(IProject *project, const IndexedString &url)
+{
+    QPair<IProject *, uint> key(project, url.index());
+    {
+        QReadLocker locker(&m_lock);
+        QHash<QPair<IProject *, uint>, QString>::const_iterator it = m_folderNamespaces.constFind(key);
+        if (it != m_folderNamespaces.constEnd())
+            return *it;
+    }
+
+    QWriteLocker locker(&m_lock);
+    // Not cached, the project may still be prepared
+    QHash<IProject *, IncludeTrie>::const_iterator prepared = m_includeTries.constFind(project);
+    if (prepared == m_includeTries.constEnd())
+        return QString();
+    const IncludeTrie &trie = *prepared;
+
+    QString result;
+    if (trie.size() > 1)
+    {
+        QStringList folders = url.str().split('/', QString::SkipEmptyParts);
+        if (!folders.isEmpty())
+            folders.removeLast();
+
+        // The outermost include directory containing url is the first one met from the root
+        int node = 0, matched = 0;
+        for (int i = 0; i < folders.size() && !trie[node].includeDirectory; ++i)
+        {
+            node = trie[node].children.value(folders[i], -1);
+            if (node == -1)
+                break;
+            if (trie[node].includeDirectory)
+                matched = i + 1;
+        }
+        result = QStringList(folders.mid(matched)).join("::");
+    }
+
+    m_folderNamespaces.insert(key, result);
+    return result;
+}
+
+void ControlFlowGraphLocationResolver::invalidate()
+{
+    QWriteLocker locker(&m_lock);
+    m_includeTries.clear();
+    m_projects.clear();
+    m_folderNamespaces.clear();
+}
+
+void ControlFlowGraphLocationResolver::invalidateProject(KDevelop::IProject *project)
+{
+    QWriteLocker locker(&m_lock);
+    m_includeTries.remove(project);
+    m_projects.clear();
+    removeFolderNamespaces(project);
+}
+
+void ControlFlowGraphLocationResolver::removeFolderNamespaces(IProject *project)
+{
+    QHash<QPair<IProject *, uint>, QString>::iterator it = m_folderNamespaces.begin();
+    while (it != m_folderNamespaces.end())
+    {
+        if (it.key().first == project)
+            it = m_folderNamespaces.erase(it);
+        else
+            ++it;
+    }
+}
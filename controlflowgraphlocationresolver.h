@@ -0,0 +1,78 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHLOCATIONRESOLVER_H
+#define CONTROLFLOWGRAPHLOCATIONRESOLVER_H
+
+#include <QHash>
+#include <QPair>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include <QReadWriteLock>
+
+#include <language/duchain/indexedstring.h>
+
+namespace KDevelop
+{
+    class IProject;
+}
+
+using namespace KDevelop;
+
+// Resolves the project and the folder namespace of document urls for the graph labels and
+// clusters. Include directories are kept in a path trie per project and every answer is
+// cached until a project is opened, closed or reconfigured.
+class ControlFlowGraphLocationResolver : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ControlFlowGraphLocationResolver(QObject *parent = 0);
+    virtual ~ControlFlowGraphLocationResolver();
+
+    // Must be called from the GUI thread, build system managers are not thread-safe
+    void prepareProject(IProject *project);
+
+    IProject *projectForUrl(const IndexedString &url);
+    // Folders of url below the outermost include directory of project, joined by "::".
+    // Empty when project has no include directories, or was not prepared yet.
+    QString folderNamespace(IProject *project, const IndexedString &url);
+
+public Q_SLOTS:
+    void invalidate();
+    void invalidateProject(KDevelop::IProject *project);
+
+private:
+    // The write lock is held by the caller
+    void removeFolderNamespaces(IProject *project);
+
+    struct TrieNode
+    {
+        QHash<QString, int> children;
+        bool includeDirectory;
+    };
+    typedef QVector<TrieNode> IncludeTrie;
+
+    QReadWriteLock m_lock;
+    QHash<IProject *, IncludeTrie> m_includeTries;
+    QHash<uint, IProject *> m_projects;
+    QHash<QPair<IProject *, uint>, QString> m_folderNamespaces;
+};
+
+#endif
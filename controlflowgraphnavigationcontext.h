@@ -41,7 +41,7 @@ public:
 public Q_SLOTS:
     void slotAnchorClicked(const QUrl &link);
 private:
-    const QString &m_label;
+    QString m_label;
     QList< QPair<RangeInRevision, IndexedString> > m_arcUses;
 };
 
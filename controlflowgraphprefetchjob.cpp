@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphprefetchjob.h"
+
+#include <QThread>
+#include <QMutexLocker>
+
+#include <language/duchain/duchain.h>
+#include <language/duchain/duchainlock.h>
+#include <language/duchain/declaration.h>
+
+ControlFlowGraphPrefetchJob::ControlFlowGraphPrefetchJob(const ControlFlowGraphTraversal::Settings &settings, IProject *project,
+                                                         ControlFlowGraphLocationResolver *locationResolver, const QList<IndexedDeclaration> &definitions)
+: m_settings(settings),
+  m_project(project),
+  m_locationResolver(locationResolver),
+  m_definitions(definitions),
+  m_prefetcher(0),
+  m_abort(false)
+{
+}
+
+ControlFlowGraphPrefetchJob::~ControlFlowGraphPrefetchJob()
+{
+    typedef QPair<DUChainControlFlow::GraphKey, DUChainControlFlow::CachedGraph *> Graph;
+    foreach (const Graph &graph, m_graphs)
+        delete graph.second;
+}
+
+void ControlFlowGraphPrefetchJob::requestAbort()
+{
+    QMutexLocker locker(&m_mutex);
+    m_abort = true;
+    if (m_prefetcher)
+        m_prefetcher->requestAbort();
+}
+
+QList<QPair<DUChainControlFlow::GraphKey, DUChainControlFlow::CachedGraph *> > ControlFlowGraphPrefetchJob::takeGraphs()
+{
+    QList<QPair<DUChainControlFlow::GraphKey, DUChainControlFlow::CachedGraph *> > graphs = m_graphs;
+    m_graphs.clear();
+    return graphs;
+}
+
+void ControlFlowGraphPrefetchJob::run()
+{
+    // Speculative work only uses otherwise idle time
+    QThread::Priority priority = QThread::currentThread()->priority();
+    QThread::currentThread()->setPriority(QThread::IdlePriority);
+
+    foreach (const IndexedDeclaration &definition, m_definitions)
+    {
+        DUChainControlFlow::GraphKey graphKey = { IndexedDUContext(), m_settings };
+        {
+            DUChainReadLocker lock(DUChain::lock());
+            if (!definition.data() || !definition.data()->internalContext())
+                continue;
+            graphKey.context = IndexedDUContext(definition.data()->internalContext());
+        }
+
+        ControlFlowGraphData graphData;
+        ControlFlowGraphTraversal prefetcher(&graphData);
+        prefetcher.setSettings(m_settings);
+        prefetcher.setProject(m_project);
+        prefetcher.setLocationResolver(m_locationResolver);
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_abort)
+                break;
+            m_prefetcher = &prefetcher;
+        }
+
+        prefetcher.generateControlFlowForDefinition(definition);
+        prefetcher.collectIncomingArcs();
+        {
+            QMutexLocker locker(&m_mutex);
+            m_prefetcher = 0;
+            if (m_abort)
+                break;
+        }
+        prefetcher.pruneFunctionBodies();
+
+        DUChainControlFlow::CachedGraph *cachedGraph = new DUChainControlFlow::CachedGraph;
+        cachedGraph->graphData = graphData;
+        cachedGraph->visitedFunctions = prefetcher.visitedFunctions();
+        cachedGraph->edgeUses = prefetcher.edgeUses();
+        cachedGraph->functionBodies = prefetcher.functionBodies();
+        m_graphs.append(qMakePair(graphKey, cachedGraph));
+    }
+
+    QThread::currentThread()->setPriority(priority);
+}
@@ -0,0 +1,61 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHPREFETCHJOB_H
+#define CONTROLFLOWGRAPHPREFETCHJOB_H
+
+#include <QList>
+#include <QPair>
+#include <QMutex>
+#include <QPointer>
+#include <QAtomicInt>
+
+#include <ThreadWeaver/Job>
+
+#include "duchaincontrolflow.h"
+
+// Generates, while the IDE is idle, the interactive graphs of functions the cursor is likely to
+// visit next, with the settings of the view it was created for. It owns everything it uses, so
+// it can outlive that view, and stops at the next abort check once requestAbort() is called.
+class ControlFlowGraphPrefetchJob : public ThreadWeaver::Job
+{
+    Q_OBJECT
+public:
+    ControlFlowGraphPrefetchJob(const ControlFlowGraphTraversal::Settings &settings, IProject *project,
+                                ControlFlowGraphLocationResolver *locationResolver, const QList<IndexedDeclaration> &definitions);
+    virtual ~ControlFlowGraphPrefetchJob();
+
+    virtual void requestAbort();
+    // Graphs generated before the job finished or was aborted, the caller takes them
+    QList<QPair<DUChainControlFlow::GraphKey, DUChainControlFlow::CachedGraph *> > takeGraphs();
+protected:
+    void run();
+private:
+    ControlFlowGraphTraversal::Settings m_settings;
+    QPointer<IProject> m_project;
+    QPointer<ControlFlowGraphLocationResolver> m_locationResolver;
+    QList<IndexedDeclaration> m_definitions;
+    QList<QPair<DUChainControlFlow::GraphKey, DUChainControlFlow::CachedGraph *> > m_graphs;
+
+    QMutex m_mutex;
+    ControlFlowGraphTraversal *m_prefetcher;
+    QAtomicInt m_abort;
+};
+
+#endif
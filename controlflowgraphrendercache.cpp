@@ -0,0 +1,149 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphrendercache.h"
+
+#include <utime.h>
+
+#include <QDir>
+#include <QFile>
+#include <QDateTime>
+#include <QDataStream>
+#include <QFileInfoList>
+#include <QMutexLocker>
+#include <QCryptographicHash>
+
+#include <KDebug>
+#include <KGlobal>
+#include <KSaveFile>
+#include <KConfigGroup>
+#include <KStandardDirs>
+
+#include <interfaces/icore.h>
+#include <interfaces/isession.h>
+
+#include "controlflowgraphdata.h"
+
+using namespace KDevelop;
+
+namespace {
+    // Changes to how graphs are built or rendered must bump this, so older entries are never served
+    const quint32 CACHE_VERSION = 3;
+}
+
+ControlFlowGraphRenderCache::ControlFlowGraphRenderCache()
+{
+    KConfigGroup group(KGlobal::config(), "Control Flow Graph");
+    m_enabled = group.readEntry("RenderCacheEnabled", true);
+    m_maximumSize = group.readEntry("RenderCacheSize", 256) * Q_INT64_C(1024) * 1024;
+    m_maximumAge = group.readEntry("RenderCacheMaxAge", 30);
+
+    m_directory = KStandardDirs::locateLocal("cache", "kdevcontrolflowgraph/" + ICore::self()->activeSession()->id().toString() + '/', true);
+    if (m_enabled)
+        evict();
+}
+
+ControlFlowGraphRenderCache::~ControlFlowGraphRenderCache()
+{
+}
+
+bool ControlFlowGraphRenderCache::isEnabled() const
+{
+    return m_enabled;
+}
+
+QByteArray ControlFlowGraphRenderCache::graphKey(const ControlFlowGraphData &graphData, const QByteArray &layoutOptions)
+{
+    // Element order is part of the key, since node names in the output are derived from it
+    QByteArray content;
+    QDataStream stream(&content, QIODevice::WriteOnly);
+    stream << CACHE_VERSION << layoutOptions;
+
+    stream << graphData.clusters().size();
+    foreach (const ControlFlowGraphData::Cluster &cluster, graphData.clusters())
+        stream << cluster.parent << cluster.label;
+    stream << graphData.nodes().size();
+    foreach (const ControlFlowGraphData::Node &node, graphData.nodes())
+        stream << node.cluster << node.label;
+    stream << graphData.edges().size();
+    foreach (const ControlFlowGraphData::Edge &edge, graphData.edges())
+        stream << edge.source << edge.target << edge.calls;
+
+    return QCryptographicHash::hash(content, QCryptographicHash::Sha1).toHex();
+}
+
+QString ControlFlowGraphRenderCache::layoutPath(const QByteArray &key) const
+{
+    return m_directory + QString::fromLatin1(key) + ".layout.dot";
+}
+
+QString ControlFlowGraphRenderCache::renderPath(const QByteArray &key, const QString &format) const
+{
+    return m_directory + QString::fromLatin1(key) + '.' + format;
+}
+
+bool ControlFlowGraphRenderCache::lookup(const QString &path)
+{
+    if (!m_enabled)
+        return false;
+
+    QMutexLocker locker(&m_mutex);
+    if (!QFile::exists(path))
+        return false;
+
+    // The modification time doubles as last use for eviction
+    utime(QFile::encodeName(path).constData(), 0);
+    return true;
+}
+
+bool ControlFlowGraphRenderCache::store(const QString &path, const QByteArray &content)
+{
+    // A failed or partial write never replaces, or shows up as, an entry
+    KSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(content) != content.size() || !file.finalize())
+    {
+        file.abort();
+        kDebug() << "Could not store" << path << "in the render cache";
+        return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    evict();
+    return true;
+}
+
+void ControlFlowGraphRenderCache::evict()
+{
+    QDir directory(m_directory);
+    QFileInfoList entries = directory.entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+
+    qint64 size = 0;
+    foreach (const QFileInfo &entry, entries)
+        size += entry.size();
+
+    QDateTime oldest = QDateTime::currentDateTime().addDays(-m_maximumAge);
+    foreach (const QFileInfo &entry, entries)
+    {
+        if (size <= m_maximumSize && (m_maximumAge == 0 || entry.lastModified() >= oldest))
+            break;
+        if (directory.remove(entry.fileName()))
+            size -= entry.size();
+    }
+    kDebug() << "Render cache size:" << size << "bytes";
+}
@@ -0,0 +1,62 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHRENDERCACHE_H
+#define CONTROLFLOWGRAPHRENDERCACHE_H
+
+#include <QMutex>
+#include <QString>
+#include <QByteArray>
+
+class ControlFlowGraphData;
+
+// Laid out graphs and rendered exports stored under the session cache directory, named by a hash
+// of the graph content and of every option affecting them, and evicted least recently used first.
+class ControlFlowGraphRenderCache
+{
+public:
+    // Streamed exports need no layout, so they are never cached. Failed ones are not either
+    enum Hit { Miss, LayoutHit, RenderHit, Streamed, Failed };
+
+    // Size and age limits are read from the "Control Flow Graph" configuration group
+    ControlFlowGraphRenderCache();
+    ~ControlFlowGraphRenderCache();
+
+    bool isEnabled() const;
+    static QByteArray graphKey(const ControlFlowGraphData &graphData, const QByteArray &layoutOptions);
+    // Graph with layout positions, as written by the dot renderer
+    QString layoutPath(const QByteArray &key) const;
+    QString renderPath(const QByteArray &key, const QString &format) const;
+
+    // True if path is cached, marking it as recently used
+    bool lookup(const QString &path);
+    // Writes content to path, through a temporary file renamed once complete, then evicts older
+    // entries beyond the limits
+    bool store(const QString &path, const QByteArray &content);
+private:
+    void evict();
+
+    QString m_directory;
+    bool m_enabled;
+    qint64 m_maximumSize;
+    int m_maximumAge;
+    QMutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,786 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphtraversal.h"
+
+#include <QThread>
+
+#include <KLocale>
+#include <KDebug>
+
+#include <interfaces/iproject.h>
+
+#include <language/duchain/use.h>
+#include <language/duchain/uses.h>
+#include <language/duchain/duchain.h>
+#include <language/duchain/ducontext.h>
+#include <language/duchain/declaration.h>
+#include <language/duchain/topducontext.h>
+#include <language/duchain/declarationid.h>
+#include <language/duchain/duchainlock.h>
+#include <language/duchain/duchainutils.h>
+#include <language/duchain/indexedstring.h>
+#include <language/duchain/functiondefinition.h>
+#include <language/duchain/types/functiontype.h>
+
+#include "controlflowgraphindex.h"
+#include "controlflowgraphlocationresolver.h"
+
+// The DUChain lock is released after expanding this many functions or holding it this many milliseconds
+static const int YIELD_STEPS = 32;
+static const int YIELD_INTERVAL = 20;
+
+ControlFlowGraphTraversal::Settings::Settings()
+: controlFlowMode(ControlFlowClass),
+  clusteringModes(ClusteringNamespace),
+  maxLevel(2),
+  maxCallerLevel(1),
+  drawIncomingArcs(true),
+  useFolderName(true),
+  useShortNames(true),
+  lazyEdgeUses(false)
+{
+}
+
+bool ControlFlowGraphTraversal::Settings::operator==(const Settings &other) const
+{
+    return controlFlowMode == other.controlFlowMode && clusteringModes == other.clusteringModes &&
+           maxLevel == other.maxLevel && maxCallerLevel == other.maxCallerLevel &&
+           drawIncomingArcs == other.drawIncomingArcs && useFolderName == other.useFolderName &&
+           useShortNames == other.useShortNames && lazyEdgeUses == other.lazyEdgeUses;
+}
+
+uint qHash(const ControlFlowGraphTraversal::Settings &settings)
+{
+    return (settings.controlFlowMode << 24) ^ (settings.clusteringModes << 16) ^ (settings.maxLevel << 4) ^ (settings.maxCallerLevel << 10) ^
+           (settings.lazyEdgeUses << 3) ^ (settings.useFolderName << 2) ^ (settings.useShortNames << 1) ^ settings.drawIncomingArcs;
+}
+
+ControlFlowGraphTraversal::ControlFlowGraphTraversal(ControlFlowGraphData *graphData)
+: m_graphData(graphData),
+  m_project(0),
+  m_abort(false),
+  m_currentLevel(1),
+  m_lockedSteps(0),
+  m_declarationInfoHits(0),
+  m_declarationInfoMisses(0),
+  m_callGraphIndex(0),
+  m_locationResolver(0)
+{
+}
+
+ControlFlowGraphTraversal::~ControlFlowGraphTraversal()
+{
+    clearDeclarationInfo();
+}
+
+const ControlFlowGraphTraversal::Settings &ControlFlowGraphTraversal::settings() const
+{
+    return m_settings;
+}
+
+void ControlFlowGraphTraversal::setSettings(const Settings &settings)
+{
+    m_settings = settings;
+    m_edgeUses.setLazy(settings.lazyEdgeUses);
+}
+
+IProject *ControlFlowGraphTraversal::project() const
+{
+    return m_project;
+}
+
+void ControlFlowGraphTraversal::setProject(IProject *project)
+{
+    m_project = project;
+}
+
+ControlFlowGraphLocationResolver *ControlFlowGraphTraversal::locationResolver() const
+{
+    return m_locationResolver;
+}
+
+void ControlFlowGraphTraversal::setLocationResolver(ControlFlowGraphLocationResolver *locationResolver)
+{
+    m_locationResolver = locationResolver;
+}
+
+void ControlFlowGraphTraversal::setCallGraphIndex(ControlFlowGraphIndex *callGraphIndex)
+{
+    m_callGraphIndex = callGraphIndex;
+}
+
+void ControlFlowGraphTraversal::requestAbort()
+{
+    m_abort = true;
+}
+
+bool ControlFlowGraphTraversal::isAborted() const
+{
+    return m_abort;
+}
+
+const QHash<IndexedDeclaration, int> &ControlFlowGraphTraversal::visitedFunctions() const
+{
+    return m_visitedFunctions;
+}
+
+const ControlFlowGraphEdgeUses &ControlFlowGraphTraversal::edgeUses() const
+{
+    return m_edgeUses;
+}
+
+const QHash<IndexedDeclaration, ControlFlowGraphTraversal::FunctionBody> &ControlFlowGraphTraversal::functionBodies() const
+{
+    return m_functionBodies;
+}
+
+void ControlFlowGraphTraversal::lockReleased()
+{
+}
+
+void ControlFlowGraphTraversal::generateControlFlowForDefinition(const IndexedDeclaration &idefinition)
+{
+    IndexedTopDUContext itopContext;
+    IndexedDUContext iinternalContext;
+    {
+        DUChainReadLocker lock(DUChain::lock());
+        Declaration *definition = idefinition.data();
+        if (!definition || !definition->internalContext())
+            return;
+        itopContext = IndexedTopDUContext(definition->topContext());
+        iinternalContext = IndexedDUContext(definition->internalContext());
+    }
+    generateControlFlowForDeclaration(idefinition, itopContext, iinternalContext);
+}
+
+void ControlFlowGraphTraversal::generateControlFlowForDeclaration(IndexedDeclaration idefinition, IndexedTopDUContext itopContext, IndexedDUContext iuppermostExecutableContext)
+{
+    // The lock is released at yield points, only indexed handles are kept across them
+    DUChainReadLocker lock(DUChain::lock());
+    m_lockedSteps = 0;
+    m_lockTimer.start();
+
+    Declaration *definition = idefinition.data();
+    if (!definition)
+        return;
+    
+    TopDUContext *topContext = itopContext.data();
+    if (!topContext)
+        return;
+
+    DUContext *uppermostExecutableContext = iuppermostExecutableContext.data();
+    if (!uppermostExecutableContext)
+        return;
+
+    Declaration *nodeDefinition = declarationInfo(definition).nodeDeclaration.data();
+
+    if (m_settings.maxLevel != 1 && !m_visitedFunctions.contains(idefinition) && nodeDefinition && nodeDefinition->internalContext())
+    {
+        m_visitedFunctions.insert(idefinition, functionNode(definition));
+
+        m_currentLevel = 1;
+        expandFunction(definition, topContext, uppermostExecutableContext);
+        expandPendingFunctions(lock);
+    }
+
+    if (m_abort)
+        return;
+
+    // Resolved again since the lock may have been released
+    definition = idefinition.data();
+    topContext = itopContext.data();
+    if (m_settings.drawIncomingArcs && definition && topContext)
+    {
+        Declaration *declaration = definition;
+        if (declaration->isDefinition())
+            declaration = DUChainUtils::declarationForDefinition(declaration, topContext);
+
+        // Prefer the project call graph index, if it is complete it knows every caller of declaration within the
+        // project. Declarations also used outside of it have their callers searched in the uses repository
+        ControlFlowGraphIndex *index = m_callGraphIndex;
+        if (!index && (index = ControlFlowGraphIndex::forProject(m_project)) && !index->isComplete())
+            index = 0;
+        if (index && declaration && !isIndexedEverywhere(index, declaration))
+            index = 0;
+
+        // Callers of callers are only found by collectIncomingArcs()
+        if (declaration && index && m_settings.maxCallerLevel == 1)
+        {
+            IndexedDeclaration ideclaration(declaration);
+            typedef QPair<IndexedDeclaration, int> CallSites;
+            foreach (const CallSites &callSites, index->callers(ideclaration))
+            {
+                if (!yieldLock(lock) || !(declaration = ideclaration.data()))
+                    break;
+
+                Declaration *caller = callSites.first.data();
+                if (!caller || !caller->internalContext())
+                    continue;
+                // Lazy edge uses find the ranges on hover, otherwise only the caller body is walked to recover them
+                if (m_edgeUses.isLazy())
+                {
+                    addFunctionCall(caller, declaration, Use(), true, callSites.second);
+                    continue;
+                }
+                QVector<Use> uses;
+                ControlFlowGraphEdgeUses::findUses(caller->topContext(), caller->internalContext(), declaration, uses);
+                foreach (const Use &use, uses)
+                    addFunctionCall(caller, declaration, use, true);
+            }
+        }
+        else if (declaration)
+        {
+            // Collected for every root at once by collectIncomingArcs()
+            m_usesCollector.addDeclaration(declaration);
+        }
+    }
+
+    m_currentLevel = 1;
+}
+
+bool ControlFlowGraphTraversal::isIndexedEverywhere(ControlFlowGraphIndex *index, Declaration *declaration)
+{
+    if (!index->containsTopContext(declaration->topContext()->ownIndex()))
+        return false;
+
+    uint topContextCount = 0;
+    const IndexedTopDUContext *topContexts = 0;
+    DUChain::uses()->uses(declaration->id(), topContextCount, topContexts);
+    for (uint i = 0; i < topContextCount; ++i)
+        if (!index->containsTopContext(topContexts[i].index()))
+            return false;
+    return true;
+}
+
+void ControlFlowGraphTraversal::expandPendingFunctions(DUChainReadLocker &lock)
+{
+    // Callees are expanded breadth first, each one at most once, until they reach the max level
+    while (!m_pendingFunctions.isEmpty() && yieldLock(lock))
+    {
+        QPair<IndexedDeclaration, int> pendingFunction = m_pendingFunctions.dequeue();
+        Declaration *calledFunctionDefinition = pendingFunction.first.data();
+        if (!calledFunctionDefinition || !calledFunctionDefinition->internalContext())
+            continue;
+
+        m_currentLevel = pendingFunction.second;
+        expandFunction(calledFunctionDefinition, calledFunctionDefinition->topContext(), calledFunctionDefinition->internalContext());
+    }
+    m_pendingFunctions.clear();
+}
+
+int ControlFlowGraphTraversal::functionNode(Declaration *definition)
+{
+    DeclarationInfo info = declarationInfo(definition);
+    Declaration *nodeDefinition = info.nodeDeclaration.data();
+    if (!nodeDefinition)
+        return -1;
+
+    int node = m_graphData->node(m_graphData->cluster(info.containers), info.nodeKey,
+                                 (m_settings.controlFlowMode == ControlFlowNamespace &&
+                                  nodeDefinition->internalContext() && nodeDefinition->internalContext()->type() != DUContext::Namespace) ?
+                                                                  globalNamespaceOrFolderNames(nodeDefinition):
+                                                                  shortNameFromContainers(info.containers, prependFolderNames(nodeDefinition)));
+    m_graphData->setNodeDeclaration(node, IndexedDeclaration(nodeDefinition));
+    return node;
+}
+
+void ControlFlowGraphTraversal::collectIncomingArcs()
+{
+    if (m_usesCollector.isEmpty())
+        return;
+
+    DUChainReadLocker lock(DUChain::lock());
+    m_lockedSteps = 0;
+    m_lockTimer.start();
+
+    // Callers are expanded a level at a time, the callers found at one level are the callees of the next
+    QSet<IndexedDeclaration> visitedCallers;
+    for (int level = 1; !m_usesCollector.isEmpty() && (level <= m_settings.maxCallerLevel || m_settings.maxCallerLevel == 0); ++level)
+    {
+        QList<IndexedDeclaration> frontier;
+
+        // Each top context using any declaration of this level is visited once
+        foreach (const IndexedTopDUContext &itopContext, m_usesCollector.topContexts())
+        {
+            if (!yieldLock(lock))
+                break;
+
+            TopDUContext *topContext = itopContext.data();
+            if (!topContext)
+                continue;
+
+            QList<ControlFlowGraphUsesCollector::Call> calls;
+            m_usesCollector.collect(topContext, calls);
+            foreach (const ControlFlowGraphUsesCollector::Call &call, calls)
+            {
+                addFunctionCall(call.caller, call.callee, call.use, true);
+
+                IndexedDeclaration icaller(call.caller);
+                if (!visitedCallers.contains(icaller))
+                {
+                    visitedCallers.insert(icaller);
+                    frontier.append(icaller);
+                }
+            }
+        }
+
+        m_usesCollector.clearDeclarations();
+        if (m_abort || level == m_settings.maxCallerLevel)
+            break;
+
+        foreach (const IndexedDeclaration &icaller, frontier)
+        {
+            Declaration *caller = icaller.data();
+            if (!caller)
+                continue;
+            Declaration *declaration = caller->isDefinition() ? DUChainUtils::declarationForDefinition(caller, caller->topContext()) : caller;
+            if (declaration)
+                m_usesCollector.addDeclaration(declaration);
+        }
+    }
+    m_usesCollector.clear();
+}
+
+bool ControlFlowGraphTraversal::yieldLock(DUChainReadLocker &lock)
+{
+    // Let the background parser and the rest of the IDE write to the DUChain now and then
+    if (++m_lockedSteps >= YIELD_STEPS || m_lockTimer.elapsed() >= YIELD_INTERVAL)
+    {
+        lock.unlock();
+        lockReleased();
+        QThread::yieldCurrentThread();
+        lock.lock();
+        m_lockedSteps = 0;
+        m_lockTimer.restart();
+    }
+    return !m_abort;
+}
+
+int ControlFlowGraphTraversal::addFunctionCall(Declaration *source, Declaration *target, const Use &use, bool incomingArc, int calls)
+{
+    // The DUChain is read locked by the caller
+    DeclarationInfo sourceInfo = declarationInfo(source);
+    DeclarationInfo targetInfo = declarationInfo(target);
+
+    QStringList sourceContainers = sourceInfo.containers;
+    if (incomingArc)
+        sourceContainers.prepend(i18n("Uses of %1", targetInfo.label));
+
+    int sourceNode = m_graphData->node(m_graphData->cluster(sourceContainers), sourceInfo.nodeKey, sourceInfo.label);
+    int targetNode = m_graphData->node(m_graphData->cluster(targetInfo.containers), targetInfo.nodeKey, targetInfo.label);
+    int edge = m_graphData->edge(sourceNode, targetNode, calls);
+
+    if (incomingArc)
+        m_graphData->setNodeDeclaration(sourceNode, sourceInfo.nodeDeclaration);
+
+    // Store use for edge inspection
+    m_edgeUses.addUse(edge, qMakePair(IndexedDeclaration(source), IndexedDeclaration(target)), source->url(), use.m_range, calls);
+
+    IndexedDeclaration ideclaration = targetInfo.definition;
+    Declaration *calledFunctionDefinition = ideclaration.data();
+    if (!calledFunctionDefinition)
+    {
+        // Store method declaration for navigation
+        m_graphData->setNodeDeclaration(targetNode, targetInfo.nodeDeclaration);
+        return edge;
+    }
+
+    // Store method definition for navigation
+    m_graphData->setNodeDeclaration(targetNode, targetInfo.definitionNodeDeclaration);
+
+    DUContext *calledFunctionContext = calledFunctionDefinition->internalContext();
+    // The called function is one level below the function being expanded
+    if (!incomingArc && calledFunctionContext && (m_currentLevel + 1 < m_settings.maxLevel || m_settings.maxLevel == 0))
+    {
+        // For prevent endless loop in recursive methods
+        if (!m_visitedFunctions.contains(ideclaration))
+        {
+            m_visitedFunctions.insert(ideclaration, targetNode);
+            m_pendingFunctions.enqueue(qMakePair(ideclaration, m_currentLevel + 1));
+        }
+    }
+    return edge;
+}
+
+ControlFlowGraphTraversal::DeclarationInfo ControlFlowGraphTraversal::declarationInfo(Declaration *declaration)
+{
+    IndexedDeclaration ideclaration(declaration);
+    QHash<IndexedDeclaration, DeclarationInfo>::const_iterator it = m_declarationInfo.constFind(ideclaration);
+    if (it != m_declarationInfo.constEnd())
+    {
+        ++m_declarationInfoHits;
+        return *it;
+    }
+    ++m_declarationInfoMisses;
+
+    DeclarationInfo info;
+
+    // Convert to a declaration in accordance with control flow mode (function, class or namespace)
+    Declaration *nodeDeclaration = declarationFromControlFlowMode(declaration);
+    info.nodeDeclaration = IndexedDeclaration(nodeDeclaration);
+    info.nodeKey = nodeKey(nodeDeclaration);
+
+    prepareContainers(info.containers, declaration);
+    info.label = shortNameFromContainers(info.containers,
+                 (m_settings.controlFlowMode == ControlFlowNamespace &&
+                  (nodeDeclaration->internalContext() && nodeDeclaration->internalContext()->type() != DUContext::Namespace)) ?
+                                   globalNamespaceOrFolderNames(nodeDeclaration) :
+                                   prependFolderNames(nodeDeclaration));
+
+    // Try to acquire the called function definition
+    Declaration *definition = FunctionDefinition::definition(declaration);
+    info.definition = IndexedDeclaration(definition);
+    if (definition)
+        info.definitionNodeDeclaration = IndexedDeclaration(declarationFromControlFlowMode(definition));
+
+    m_declarationInfo.insert(ideclaration, info);
+    return info;
+}
+
+void ControlFlowGraphTraversal::clearDeclarationInfo()
+{
+    if (m_declarationInfoHits || m_declarationInfoMisses)
+        kDebug() << "Declaration info cache:" << m_declarationInfoHits << "hits," << m_declarationInfoMisses << "misses";
+
+    m_declarationInfo.clear();
+    m_declarationInfoHits = 0;
+    m_declarationInfoMisses = 0;
+}
+
+void ControlFlowGraphTraversal::expandFunction(Declaration *definition, TopDUContext *topContext, DUContext *context)
+{
+    // Exports read the calls from the project call graph index when it covers the definition
+    if (m_callGraphIndex && topContext && m_callGraphIndex->containsTopContext(topContext->ownIndex()))
+    {
+        typedef QPair<IndexedDeclaration, int> CallSites;
+        foreach (const CallSites &callSites, m_callGraphIndex->callees(IndexedDeclaration(definition)))
+        {
+            if (m_abort)
+                return;
+            Declaration *callee = callSites.first.data();
+            if (callee)
+                addFunctionCall(definition, callee, Use(), false, callSites.second);
+        }
+    }
+    else
+    {
+        // Bodies are only walked again when their uses changed since the previous graph
+        IndexedDeclaration idefinition(definition);
+        uint hash = bodyHash(topContext, context);
+        if (!m_functionBodies.contains(idefinition) || m_functionBodies[idefinition].hash != hash)
+        {
+            FunctionBody body;
+            body.context = IndexedDUContext(context);
+            body.hash = hash;
+            useDeclarationsFromDefinition(topContext, context, body.calls);
+            if (m_abort)
+                return;
+            m_functionBodies.insert(idefinition, body);
+        }
+
+        FunctionBody &body = m_functionBodies[idefinition];
+        body.level = m_currentLevel;
+        body.edgeCalls.clear();
+        const QVector<QPair<IndexedDeclaration, RangeInRevision> > calls = body.calls;
+        for (int i = 0; i < calls.size(); ++i)
+        {
+            if (m_abort)
+                return;
+            Declaration *callee = calls[i].first.data();
+            if (callee)
+                ++body.edgeCalls[addFunctionCall(definition, callee, Use(calls[i].second), false)];
+        }
+    }
+}
+
+uint ControlFlowGraphTraversal::bodyHash(TopDUContext *topContext, DUContext *context)
+{
+    uint hash = context->usesCount();
+    const Use *uses = context->uses();
+    for (int i = 0; i < context->usesCount(); ++i)
+    {
+        const RangeInRevision &range = uses[i].m_range;
+        hash = hash * 31 + topContext->usedDeclarationIdForIndex(uses[i].m_declarationIndex).hash();
+        hash = hash * 31 + ((range.start.line << 16) ^ range.start.column);
+        hash = hash * 31 + ((range.end.line << 16) ^ range.end.column);
+    }
+
+    foreach (DUContext *child, context->childContexts())
+        if (child->type() == DUContext::Other)
+            hash = hash * 17 + bodyHash(topContext, child);
+
+    return hash;
+}
+
+QList<IndexedDeclaration> ControlFlowGraphTraversal::changedFunctionBodies()
+{
+    QList<IndexedDeclaration> changedBodies;
+    for (QHash<IndexedDeclaration, FunctionBody>::const_iterator it = m_functionBodies.constBegin(); it != m_functionBodies.constEnd(); ++it)
+    {
+        DUContext *context = it->context.data();
+        if (!context || bodyHash(context->topContext(), context) != it->hash)
+            changedBodies.append(it.key());
+    }
+    return changedBodies;
+}
+
+void ControlFlowGraphTraversal::updateFunctionBodies(const QList<IndexedDeclaration> &changedBodies, const IndexedDeclaration &root, QVector<int> &clusterMap)
+{
+    DUChainReadLocker lock(DUChain::lock());
+    m_lockedSteps = 0;
+    m_lockTimer.start();
+
+    // The calls of the previous bodies are taken back first, the new bodies may still make some of them
+    foreach (const IndexedDeclaration &idefinition, changedBodies)
+    {
+        QHash<IndexedDeclaration, FunctionBody>::iterator body = m_functionBodies.find(idefinition);
+        if (body == m_functionBodies.end())
+            continue;
+        for (QHash<int, int>::const_iterator edge = body->edgeCalls.constBegin(); edge != body->edgeCalls.constEnd(); ++edge)
+        {
+            m_graphData->removeCalls(edge.key(), edge.value());
+            m_edgeUses.removeCaller(edge.key(), idefinition);
+        }
+        body->edgeCalls.clear();
+    }
+
+    // Callees reached for the first time are expanded below the changed function, as in a new graph
+    foreach (const IndexedDeclaration &idefinition, changedBodies)
+    {
+        if (!yieldLock(lock))
+            return;
+
+        QHash<IndexedDeclaration, FunctionBody>::iterator body = m_functionBodies.find(idefinition);
+        if (body == m_functionBodies.end())
+            continue;
+        Declaration *definition = idefinition.data();
+        DUContext *context = definition ? definition->internalContext() : 0;
+        if (!context)
+        {
+            m_functionBodies.erase(body);
+            continue;
+        }
+        m_currentLevel = body->level;
+        expandFunction(definition, context->topContext(), context);
+    }
+    expandPendingFunctions(lock);
+    if (m_abort)
+        return;
+
+    Declaration *rootDefinition = root.data();
+    int rootNode = rootDefinition ? functionNode(rootDefinition) : -1;
+    if (rootNode == -1)
+        return;
+
+    QVector<int> nodeMap, edgeMap;
+    m_graphData->prune(rootNode, nodeMap, edgeMap, clusterMap);
+    m_edgeUses.remapEdges(edgeMap);
+
+    // Functions whose node was dropped are expanded again once something calls them
+    QHash<IndexedDeclaration, int>::iterator visited = m_visitedFunctions.begin();
+    while (visited != m_visitedFunctions.end())
+    {
+        int node = (*visited >= 0 && *visited < nodeMap.size()) ? nodeMap[*visited] : -1;
+        if (node == -1)
+        {
+            m_functionBodies.remove(visited.key());
+            visited = m_visitedFunctions.erase(visited);
+            continue;
+        }
+        *visited = node;
+        ++visited;
+    }
+
+    for (QHash<IndexedDeclaration, FunctionBody>::iterator body = m_functionBodies.begin(); body != m_functionBodies.end(); ++body)
+    {
+        QHash<int, int> edgeCalls;
+        for (QHash<int, int>::const_iterator edge = body->edgeCalls.constBegin(); edge != body->edgeCalls.constEnd(); ++edge)
+            if (edgeMap.value(edge.key(), -1) != -1)
+                edgeCalls.insert(edgeMap[edge.key()], edge.value());
+        body->edgeCalls = edgeCalls;
+    }
+}
+
+void ControlFlowGraphTraversal::pruneFunctionBodies()
+{
+    QHash<IndexedDeclaration, FunctionBody>::iterator it = m_functionBodies.begin();
+    while (it != m_functionBodies.end())
+    {
+        if (m_visitedFunctions.contains(it.key()))
+            ++it;
+        else
+            it = m_functionBodies.erase(it);
+    }
+}
+
+void ControlFlowGraphTraversal::useDeclarationsFromDefinition (TopDUContext *topContext, DUContext *context, QVector<QPair<IndexedDeclaration, RangeInRevision> > &calls)
+{
+    if (!topContext) return;
+
+    const Use *uses = context->uses();
+    unsigned int usesCount = context->usesCount();
+    QVector<DUContext *> subContexts = context->childContexts();
+    QVector<DUContext *>::iterator subContextsIterator = subContexts.begin();
+    QVector<DUContext *>::iterator subContextsEnd      = subContexts.end();
+
+    Declaration *declaration;
+    for (unsigned int i = 0; i < usesCount; ++i)
+    {
+        if (m_abort)
+            return;
+
+        declaration = topContext->usedDeclarationForIndex(uses[i].m_declarationIndex);
+        if (declaration && declaration->type<KDevelop::FunctionType>())
+        {
+            if (subContextsIterator != subContextsEnd)
+            {
+                if (uses[i].m_range.start < (*subContextsIterator)->range().start)
+                    calls.append(qMakePair(IndexedDeclaration(declaration), uses[i].m_range));
+                else
+                {
+                    // Recursive call for sub-contexts, the use is then compared with the next one
+                    if ((*subContextsIterator)->type() == DUContext::Other)
+                        useDeclarationsFromDefinition(topContext, *subContextsIterator, calls);
+                    ++subContextsIterator;
+                    --i;
+                }
+            }
+            else
+                calls.append(qMakePair(IndexedDeclaration(declaration), uses[i].m_range));
+        }
+    }
+    // Recursive call for remaining sub-contexts
+    for (; subContextsIterator != subContextsEnd; ++subContextsIterator)
+        if ((*subContextsIterator)->type() == DUContext::Other)
+            useDeclarationsFromDefinition(topContext, *subContextsIterator, calls);
+}
+
+Declaration *ControlFlowGraphTraversal::declarationFromControlFlowMode(Declaration *definitionDeclaration)
+{
+    Declaration *nodeDeclaration = definitionDeclaration;
+
+    if (m_settings.controlFlowMode != ControlFlowFunction)
+    {
+        if (nodeDeclaration->isDefinition())
+            nodeDeclaration = DUChainUtils::declarationForDefinition(nodeDeclaration, nodeDeclaration->topContext());
+        if (!nodeDeclaration || !nodeDeclaration->context() || !nodeDeclaration->context()->owner()) return definitionDeclaration;
+        while (nodeDeclaration->context() &&
+               nodeDeclaration->context()->owner() &&
+               ((m_settings.controlFlowMode == ControlFlowClass && nodeDeclaration->context() && nodeDeclaration->context()->type() == DUContext::Class) ||
+                (m_settings.controlFlowMode == ControlFlowNamespace && (
+                                                              (nodeDeclaration->context() && nodeDeclaration->context()->type() == DUContext::Class) ||
+                                                              (nodeDeclaration->context() && nodeDeclaration->context()->type() == DUContext::Namespace))
+              )))
+            nodeDeclaration = nodeDeclaration->context()->owner();
+    }
+    return nodeDeclaration;
+}
+
+IndexedDeclaration ControlFlowGraphTraversal::nodeKey(Declaration *nodeDeclaration)
+{
+    // Namespaces may be opened in many places and folder names group several declarations,
+    // so in namespace mode nodes are identified by their labels
+    if (m_settings.controlFlowMode == ControlFlowNamespace)
+        return IndexedDeclaration();
+
+    return IndexedDeclaration(DUChainUtils::declarationForDefinition(nodeDeclaration, nodeDeclaration->topContext()));
+}
+
+void ControlFlowGraphTraversal::prepareContainers(QStringList &containers, Declaration* definition)
+{
+    ControlFlowMode originalControlFlowMode = m_settings.controlFlowMode;
+    QString strGlobalNamespaceOrFolderNames;
+
+    // Handling project clustering
+    IProject *project;
+    if (m_settings.clusteringModes.testFlag(ClusteringProject) && m_locationResolver &&
+        (project = m_locationResolver->projectForUrl(definition->url())))
+        containers << project->name();
+
+    // Handling namespace clustering
+    if (m_settings.clusteringModes.testFlag(ClusteringNamespace))
+    {
+        m_settings.controlFlowMode = ControlFlowNamespace;
+        Declaration *namespaceDefinition = declarationFromControlFlowMode(definition);
+
+        strGlobalNamespaceOrFolderNames = ((namespaceDefinition->internalContext() && namespaceDefinition->internalContext()->type() != DUContext::Namespace) ?
+                                                              globalNamespaceOrFolderNames(namespaceDefinition):
+                                                              shortNameFromContainers(containers, prependFolderNames(namespaceDefinition)));
+        foreach(const QString &container, strGlobalNamespaceOrFolderNames.split("::"))
+            containers << container;
+    }
+
+    // Handling class clustering
+    if (m_settings.clusteringModes.testFlag(ClusteringClass))
+    {
+        m_settings.controlFlowMode = ControlFlowClass;
+        Declaration *classDefinition = declarationFromControlFlowMode(definition);
+        
+        if (classDefinition->internalContext() && classDefinition->internalContext()->type() == DUContext::Class)
+            containers << shortNameFromContainers(containers, prependFolderNames(classDefinition));
+    }
+
+    m_settings.controlFlowMode = originalControlFlowMode;
+}
+
+QString ControlFlowGraphTraversal::globalNamespaceOrFolderNames(Declaration *declaration)
+{
+    if (m_settings.useFolderName && m_project && m_locationResolver)
+    {
+        QString folderNamespace = m_locationResolver->folderNamespace(m_project, declaration->url());
+        if (!folderNamespace.isEmpty())
+            return folderNamespace;
+    }
+    return i18n("Global Namespace");
+}
+
+QString ControlFlowGraphTraversal::prependFolderNames(Declaration *declaration)
+{
+    QString prependedQualifiedName = declaration->qualifiedIdentifier().toString();
+    if (m_settings.useFolderName)
+    {
+        ControlFlowMode originalControlFlowMode = m_settings.controlFlowMode;
+        m_settings.controlFlowMode = ControlFlowNamespace;
+        Declaration *namespaceDefinition = declarationFromControlFlowMode(declaration);
+        m_settings.controlFlowMode = originalControlFlowMode;
+
+        QString prefix = globalNamespaceOrFolderNames(namespaceDefinition);
+        
+        if (namespaceDefinition && namespaceDefinition->internalContext() &&
+            namespaceDefinition->internalContext()->type() != DUContext::Namespace &&
+            prefix != i18n("Global Namespace"))
+            prependedQualifiedName.prepend(prefix + "::");
+    }
+
+    return prependedQualifiedName;
+}
+
+QString ControlFlowGraphTraversal::shortNameFromContainers(const QList<QString> &containers, const QString &qualifiedIdentifier)
+{
+    QString shortName = qualifiedIdentifier;
+
+    if (m_settings.useShortNames)
+    {
+        foreach(const QString &container, containers)
+            if (shortName.contains(container))
+                shortName.remove(shortName.indexOf(container + "::"), (container + "::").length());
+    }
+    return shortName;
+}
@@ -0,0 +1,195 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHTRAVERSAL_H
+#define CONTROLFLOWGRAPHTRAVERSAL_H
+
+#include <QSet>
+#include <QHash>
+#include <QPair>
+#include <QQueue>
+#include <QVector>
+#include <QPointer>
+#include <QAtomicInt>
+#include <QStringList>
+#include <QElapsedTimer>
+
+#include <language/duchain/ducontext.h>
+
+#include "controlflowgraphdata.h"
+#include "controlflowgraphedgeuses.h"
+#include "controlflowgraphusescollector.h"
+
+namespace KDevelop {
+    class Use;
+    class DUChainReadLocker;
+    class Declaration;
+    class TopDUContext;
+    class IProject;
+}
+
+class ControlFlowGraphIndex;
+class ControlFlowGraphLocationResolver;
+
+using namespace KDevelop;
+
+// Walks the DUChain from function definitions into a ControlFlowGraphData. It is not a QObject
+// and touches nothing but the DUChain and the graph data, so it can be created, run and deleted
+// on any thread.
+class ControlFlowGraphTraversal
+{
+public:
+    enum ControlFlowMode { ControlFlowFunction, ControlFlowClass, ControlFlowNamespace };
+
+    enum ClusteringMode
+    {
+        ClusteringNone      = 0x0,
+        ClusteringClass     = 0x1,
+        ClusteringNamespace = 0x2,
+        ClusteringProject   = 0x4
+    };
+    Q_DECLARE_FLAGS(ClusteringModes, ClusteringMode)
+
+    // Everything deciding what a traversal draws
+    struct Settings
+    {
+        Settings();
+        bool operator==(const Settings &other) const;
+
+        ControlFlowMode controlFlowMode;
+        ClusteringModes clusteringModes;
+        int maxLevel;
+        // Levels of callers drawn as incoming arcs, 0 for no limit
+        int maxCallerLevel;
+        bool drawIncomingArcs;
+        bool useFolderName;
+        bool useShortNames;
+        // Only count call sites and search their ranges again on edge hover
+        bool lazyEdgeUses;
+    };
+
+    // Calls made by an expanded function definition, reused while the hash of its body is unchanged,
+    // and what they added to the graph, taken back when the body changes
+    struct FunctionBody
+    {
+        IndexedDUContext context;
+        uint hash;
+        QVector<QPair<IndexedDeclaration, RangeInRevision> > calls;
+        int level;
+        QHash<int, int> edgeCalls; // Call sites added to each edge
+    };
+
+    explicit ControlFlowGraphTraversal(ControlFlowGraphData *graphData);
+    virtual ~ControlFlowGraphTraversal();
+
+    const Settings &settings() const;
+    void setSettings(const Settings &settings);
+    // Project whose folders name the global namespace, and whose call graph index gives callers
+    IProject *project() const;
+    void setProject(IProject *project);
+    ControlFlowGraphLocationResolver *locationResolver() const;
+    void setLocationResolver(ControlFlowGraphLocationResolver *locationResolver);
+    // Callees are read from callGraphIndex, when it covers the function, instead of its body
+    void setCallGraphIndex(ControlFlowGraphIndex *callGraphIndex);
+
+    void generateControlFlowForDeclaration(IndexedDeclaration idefinition, IndexedTopDUContext itopContext, IndexedDUContext iuppermostExecutableContext);
+    void generateControlFlowForDefinition(const IndexedDeclaration &idefinition);
+    // Adds the incoming arcs of every root generated since the last call
+    void collectIncomingArcs();
+    // Makes the traversal stop at its next abort check, may be called from any thread
+    void requestAbort();
+    bool isAborted() const;
+
+    // Node each visited function is drawn as
+    const QHash<IndexedDeclaration, int> &visitedFunctions() const;
+    const ControlFlowGraphEdgeUses &edgeUses() const;
+    const QHash<IndexedDeclaration, FunctionBody> &functionBodies() const;
+    // Function bodies walked so far and reparsed with other uses since. The DUChain is read locked
+    QList<IndexedDeclaration> changedFunctionBodies();
+    // Walks the changed bodies again and patches their calls into the graph of root, dropping what they
+    // don't reach anymore. Incoming arcs are kept as they are. clusterMap gives the new index of every
+    // previous cluster, -1 for dropped ones
+    void updateFunctionBodies(const QList<IndexedDeclaration> &changedBodies, const IndexedDeclaration &root, QVector<int> &clusterMap);
+    // Forgets the bodies of functions that are not part of the graph anymore
+    void pruneFunctionBodies();
+    void clearDeclarationInfo();
+protected:
+    // Called from the traversal thread while the DUChain lock is released at a yield point
+    virtual void lockReleased();
+
+    ControlFlowGraphData *m_graphData;
+    Settings m_settings;
+    QPointer<IProject> m_project;
+
+    QHash<IndexedDeclaration, int> m_visitedFunctions;
+    QHash<IndexedDeclaration, FunctionBody> m_functionBodies;
+    ControlFlowGraphEdgeUses m_edgeUses;
+
+    QAtomicInt m_abort;
+private:
+    // calls is the number of call sites behind use, more than one only for calls read from the call graph index
+    int addFunctionCall(Declaration *source, Declaration *target, const Use &use, bool incomingArc, int calls = 1);
+    bool yieldLock(DUChainReadLocker &lock);
+    void expandFunction(Declaration *definition, TopDUContext *topContext, DUContext *context);
+    void expandPendingFunctions(DUChainReadLocker &lock);
+    int functionNode(Declaration *definition);
+    // Whether every top context declaring or using declaration is covered by index
+    bool isIndexedEverywhere(ControlFlowGraphIndex *index, Declaration *declaration);
+    void useDeclarationsFromDefinition(TopDUContext *topContext, DUContext *context, QVector<QPair<IndexedDeclaration, RangeInRevision> > &calls);
+    uint bodyHash(TopDUContext *topContext, DUContext *context);
+    Declaration *declarationFromControlFlowMode(Declaration *definitionDeclaration);
+    IndexedDeclaration nodeKey(Declaration *nodeDeclaration);
+
+    // Node declaration, containers and label of a call source or target, memoized per generation
+    struct DeclarationInfo
+    {
+        IndexedDeclaration nodeDeclaration;
+        IndexedDeclaration nodeKey;
+        QStringList containers;
+        QString label;
+        IndexedDeclaration definition;
+        IndexedDeclaration definitionNodeDeclaration;
+    };
+    DeclarationInfo declarationInfo(Declaration *declaration);
+    void prepareContainers(QStringList &containers, Declaration* definition);
+    QString globalNamespaceOrFolderNames(Declaration *declaration);
+    QString prependFolderNames(Declaration *declaration);
+    QString shortNameFromContainers(const QList<QString> &containers, const QString &qualifiedIdentifier);
+
+    // Called function definitions waiting for expansion, with their level
+    QQueue<QPair<IndexedDeclaration, int> > m_pendingFunctions;
+    int m_currentLevel; // Level of the function being expanded, the root is at level 1
+
+    int m_lockedSteps;
+    QElapsedTimer m_lockTimer;
+
+    QHash<IndexedDeclaration, DeclarationInfo> m_declarationInfo;
+    int m_declarationInfoHits;
+    int m_declarationInfoMisses;
+
+    ControlFlowGraphUsesCollector m_usesCollector;
+    QPointer<ControlFlowGraphIndex> m_callGraphIndex;
+    QPointer<ControlFlowGraphLocationResolver> m_locationResolver;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(ControlFlowGraphTraversal::ClusteringModes)
+
+uint qHash(const ControlFlowGraphTraversal::Settings &settings);
+
+#endif
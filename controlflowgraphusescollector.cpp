@@ -19,15 +19,16 @@
 
 #include "controlflowgraphusescollector.h"
 
-#include <language/duchain/use.h>
+#include <limits>
+
+#include <language/duchain/uses.h>
 #include <language/duchain/duchain.h>
 #include <language/duchain/declaration.h>
-#include <language/duchain/duchainlock.h>
+#include <language/duchain/declarationid.h>
 
 using namespace KDevelop;
 
-ControlFlowGraphUsesCollector::ControlFlowGraphUsesCollector(IndexedDeclaration declaration)
- : UsesCollector(declaration), m_declaration(declaration)
+ControlFlowGraphUsesCollector::ControlFlowGraphUsesCollector()
 {
 }
 
@@ -35,51 +36,100 @@ ControlFlowGraphUsesCollector::~ControlFlowGraphUsesCollector()
 {
 }
 
-void ControlFlowGraphUsesCollector::processUses(ReferencedTopDUContext topContext)
+void ControlFlowGraphUsesCollector::addDeclaration(Declaration *declaration)
 {
-    if (topContext.data())
+    IndexedDeclaration ideclaration(declaration);
+
+    // Uses in the declaring file are not registered in the uses repository
+    QList<IndexedDeclaration> &declarations = m_declarations[IndexedTopDUContext(declaration->topContext())];
+    if (!declarations.contains(ideclaration))
+        declarations.append(ideclaration);
+
+    uint topContextCount = 0;
+    const IndexedTopDUContext *topContexts = 0;
+    DUChain::uses()->uses(declaration->id(), topContextCount, topContexts);
+    for (uint i = 0; i < topContextCount; ++i)
     {
-        DUChainReadLocker lock(DUChain::lock());
-        CodeRepresentation::Ptr code = createCodeRepresentation(topContext.data()->url());
-        processContext(topContext.data(), code);
+        QList<IndexedDeclaration> &declarations = m_declarations[topContexts[i]];
+        if (!declarations.contains(ideclaration))
+            declarations.append(ideclaration);
     }
 }
 
-void ControlFlowGraphUsesCollector::processContext(DUContext *context, CodeRepresentation::Ptr code)
+QList<IndexedTopDUContext> ControlFlowGraphUsesCollector::topContexts() const
+{
+    return m_declarations.keys();
+}
+
+void ControlFlowGraphUsesCollector::collect(TopDUContext *topContext, QList<Call> &calls) const
 {
-    foreach (const IndexedDeclaration &ideclaration, declarations())
+    IndexedTopDUContext itopContext(topContext);
+    QHash<IndexedTopDUContext, CallSites>::const_iterator it = m_callSites.constFind(itopContext);
+    if (it == m_callSites.constEnd())
+    {
+        CallSites callSites;
+        collectContext(topContext, callSites);
+        it = m_callSites.insert(itopContext, callSites);
+    }
+
+    // Uses refer to declarations through indices local to topContext
+    foreach (const IndexedDeclaration &ideclaration, m_declarations.value(itopContext))
     {
         Declaration *declaration = ideclaration.data();
         if (!declaration)
             continue;
-        
-        int declarationIndex = context->topContext()->indexForUsedDeclaration(declaration, false);
+
+        int declarationIndex = topContext->indexForUsedDeclaration(declaration, false);
         if (declarationIndex == std::numeric_limits<int>::max())
             continue;
-        
+
+        foreach (const CallSite &callSite, it->value(declarationIndex))
+        {
+            Declaration *caller = callSite.caller.data();
+            if (!caller)
+                continue;
+
+            Call call = { caller, declaration, callSite.use };
+            calls.append(call);
+        }
+    }
+}
+
+void ControlFlowGraphUsesCollector::collectContext(DUContext *context, CallSites &callSites) const
+{
+    // Navigate to uppermost executable context, its owner is the calling definition
+    DUContext *uppermostExecutableContext = context;
+    while (uppermostExecutableContext->parentContext() && uppermostExecutableContext->parentContext()->type() == DUContext::Other)
+        uppermostExecutableContext = uppermostExecutableContext->parentContext();
+
+    Declaration *definition = uppermostExecutableContext->owner();
+    if (definition)
+    {
+        const Use *uses = context->uses();
         int usesCount = context->usesCount();
         for (int useIndex = 0; useIndex < usesCount; ++useIndex)
         {
-            if (context->uses()[useIndex].m_declarationIndex == declarationIndex)
-            {
-                // Navigate to uppermost executable context
-                DUContext *uppermostExecutableContext = context;
-                while (uppermostExecutableContext->parentContext() && uppermostExecutableContext->parentContext()->type() == DUContext::Other)
-                    uppermostExecutableContext = uppermostExecutableContext->parentContext();
-
-                // Get the definition
-                Declaration* definition = 0;
-                if (!uppermostExecutableContext || !uppermostExecutableContext->owner())
-                    continue;
-                else
-                    definition = uppermostExecutableContext->owner();
-
-                if (!definition) continue;
-
-                emit processFunctionCall(definition, m_declaration.data(), context->uses()[useIndex]);
-            }
+            CallSite callSite = { IndexedDeclaration(definition), uses[useIndex] };
+            callSites[uses[useIndex].m_declarationIndex].append(callSite);
         }
     }
+
     foreach (DUContext *child, context->childContexts())
-        processContext(child, code);
+        collectContext(child, callSites);
+}
+
+bool ControlFlowGraphUsesCollector::isEmpty() const
+{
+    return m_declarations.isEmpty();
+}
+
+void ControlFlowGraphUsesCollector::clearDeclarations()
+{
+    m_declarations.clear();
+}
+
+void ControlFlowGraphUsesCollector::clear()
+{
+    m_declarations.clear();
+    m_callSites.clear();
 }
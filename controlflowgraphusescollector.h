@@ -20,25 +20,53 @@
 #ifndef CONTROLFLOWGRAPHUSESCOLLECTOR_H
 #define CONTROLFLOWGRAPHUSESCOLLECTOR_H
 
-#include <language/duchain/navigation/usescollector.h>
+#include <QHash>
+#include <QList>
+#include <QVector>
 
-#include <language/codegen/coderepresentation.h>
+#include <language/duchain/use.h>
+#include <language/duchain/ducontext.h>
+#include <language/duchain/topducontext.h>
 
 using namespace KDevelop;
 
-class ControlFlowGraphUsesCollector : public UsesCollector
+// Collects the calls to a set of declarations, visiting each top context using any of
+// them once. The call sites found in a top context are kept, so later sets of declarations
+// (the next caller level) are looked up without walking it again. The DUChain must be read
+// locked while calling any method.
+class ControlFlowGraphUsesCollector
 {
-    Q_OBJECT
 public:
-    ControlFlowGraphUsesCollector(IndexedDeclaration declaration);
-    virtual ~ControlFlowGraphUsesCollector();
-Q_SIGNALS:
-    void processFunctionCall(Declaration *source, Declaration *target, const Use &use);
+    struct Call
+    {
+        Declaration *caller;
+        Declaration *callee;
+        Use use;
+    };
+
+    ControlFlowGraphUsesCollector();
+    ~ControlFlowGraphUsesCollector();
+
+    void addDeclaration(Declaration *declaration);
+    QList<IndexedTopDUContext> topContexts() const;
+    void collect(TopDUContext *topContext, QList<Call> &calls) const;
+
+    bool isEmpty() const;
+    // Forgets the declarations but keeps the call sites of visited top contexts
+    void clearDeclarations();
+    void clear();
 private:
-    virtual void processUses(ReferencedTopDUContext topContext);
-    void processContext(DUContext *context, CodeRepresentation::Ptr code);
-protected:
-    IndexedDeclaration m_declaration;
+    struct CallSite
+    {
+        IndexedDeclaration caller;
+        Use use;
+    };
+    typedef QHash<int, QVector<CallSite> > CallSites;
+    void collectContext(DUContext *context, CallSites &callSites) const;
+
+    QHash<IndexedTopDUContext, QList<IndexedDeclaration> > m_declarations;
+    // Call sites of visited top contexts, by local used declaration index
+    mutable QHash<IndexedTopDUContext, CallSites> m_callSites;
 };
 
 #endif
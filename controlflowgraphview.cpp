@@ -35,6 +35,7 @@
 #include "duchaincontrolflow.h"
 #include "dotcontrolflowgraph.h"
 #include "controlflowgraphfiledialog.h"
+#include "controlflowgraphexportjob.h"
 #include "kdevcontrolflowgraphviewplugin.h"
 
 using namespace KDevelop;
@@ -49,6 +50,8 @@ m_duchainControlFlow(new DUChainControlFlow(m_dotControlFlowGraph)),
 m_graphLocked(false)
 {
     setupUi(this);
+    m_duchainControlFlow->setLocationResolver(m_plugin->locationResolver());
+
     KLibFactory *factory = KLibLoader::self()->factory("kgraphviewerpart");
     if (factory)
     {
@@ -56,6 +59,8 @@ m_graphLocked(false)
         if (m_part)
         {
             QMetaObject::invokeMethod(m_part, "setReadWrite");
+            // Graphs arrive laid out by DotControlFlowGraph, node and edge positions are reused as they are
+            QMetaObject::invokeMethod(m_part, "setLayoutCommand", Q_ARG(QString, "nop2"));
 
             verticalLayout->addWidget(m_part->widget());
 
@@ -96,6 +101,7 @@ m_graphLocked(false)
             connect(maxLevelSpinBox, SIGNAL(valueChanged(int)), SLOT(setMaxLevel(int)));
             connect(maxLevelToolButton, SIGNAL(toggled(bool)), SLOT(setUseMaxLevel(bool)));
             connect(drawIncomingArcsToolButton, SIGNAL(toggled(bool)), SLOT(setDrawIncomingArcs(bool)));
+            connect(callerLevelSpinBox, SIGNAL(valueChanged(int)), SLOT(setMaxCallerLevel(int)));
             connect(useFolderNameToolButton, SIGNAL(toggled(bool)), SLOT(setUseFolderName(bool)));
             connect(useShortNamesToolButton, SIGNAL(toggled(bool)), SLOT(setUseShortNames(bool)));
             connect(lockControlFlowGraphToolButton, SIGNAL(toggled(bool)), SLOT(updateLockIcon(bool)));
@@ -142,6 +148,11 @@ void ControlFlowGraphView::refreshGraph()
     m_duchainControlFlow->refreshGraph();
 }
 
+void ControlFlowGraphView::updateGraph()
+{
+    m_duchainControlFlow->updateGraph();
+}
+
 void ControlFlowGraphView::newGraph()
 {
     m_duchainControlFlow->newGraph();
@@ -160,12 +171,26 @@ void ControlFlowGraphView::cursorPositionChanged(KTextEditor::View *view, const
 
 void ControlFlowGraphView::startingJob()
 {
-    setEnabled(false);
+    // Partial graphs stay browsable, only the settings and export wait for the final graph
+    QList<QWidget *> widgets;
+    widgets << exportToolButton;
+    for (int i = 0; i < horizontalUpperLayout->count(); ++i)
+        if (QWidget *widget = horizontalUpperLayout->itemAt(i)->widget())
+            widgets << widget;
+
+    foreach (QWidget *widget, widgets)
+        if (widget->isEnabled())
+        {
+            widget->setEnabled(false);
+            m_disabledWidgets << widget;
+        }
 }
 
 void ControlFlowGraphView::graphDone()
 {
-    setEnabled(true);
+    foreach (QWidget *widget, m_disabledWidgets)
+        widget->setEnabled(true);
+    m_disabledWidgets.clear();
 }
 
 void ControlFlowGraphView::exportControlFlowGraph()
@@ -173,9 +198,10 @@ void ControlFlowGraphView::exportControlFlowGraph()
     QPointer<ControlFlowGraphFileDialog> fileDialog;
     if ((fileDialog = m_plugin->exportControlFlowGraph(ControlFlowGraphFileDialog::NoConfigurationButtons)))
     {
-        m_dotControlFlowGraph->exportGraph(fileDialog->selectedFile());
-        KMessageBox::information(this, i18n("Control flow graph exported"), i18n("Export Control Flow Graph"));
+        // Rendered in the background from a copy, the view keeps following the cursor meanwhile
+        m_plugin->queueExport(new ControlFlowGraphExportJob(m_plugin, fileDialog->selectedFile(), m_dotControlFlowGraph, fileDialog->exportFiles()));
     }
+    delete fileDialog;
 }
 
 void ControlFlowGraphView::updateLockIcon(bool checked)
@@ -262,10 +288,17 @@ void ControlFlowGraphView::setMaxLevel(int value)
 
 void ControlFlowGraphView::setDrawIncomingArcs(bool checked)
 {
+    callerLevelSpinBox->setEnabled(checked);
     m_duchainControlFlow->setDrawIncomingArcs(checked);
     m_duchainControlFlow->refreshGraph();
 }
 
+void ControlFlowGraphView::setMaxCallerLevel(int value)
+{
+    m_duchainControlFlow->setMaxCallerLevel(value);
+    m_duchainControlFlow->refreshGraph();
+}
+
 void ControlFlowGraphView::setUseFolderName(bool checked)
 {
     m_duchainControlFlow->setUseFolderName(checked);
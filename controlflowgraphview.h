@@ -47,6 +47,7 @@ public:
     virtual ~ControlFlowGraphView ();
 
     void refreshGraph();
+    void updateGraph();
     void newGraph();
 public Q_SLOTS:
     void setProjectButtonsEnabled(bool enabled);
@@ -64,6 +65,7 @@ public Q_SLOTS:
     void setUseMaxLevel(bool checked);
     void setMaxLevel(int value);
     void setDrawIncomingArcs(bool checked);
+    void setMaxCallerLevel(int value);
     void setUseFolderName(bool checked);
     void setUseShortNames(bool checked);
 
@@ -80,6 +82,7 @@ private:
     QPointer<DotControlFlowGraph>   m_dotControlFlowGraph;
     QPointer<DUChainControlFlow>    m_duchainControlFlow;
     bool                            m_graphLocked;
+    QList<QWidget *>                m_disabledWidgets;
 };
 
 #endif
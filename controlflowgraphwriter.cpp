@@ -0,0 +1,272 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "controlflowgraphwriter.h"
+
+#include <QFile>
+#include <QColor>
+#include <QTextStream>
+#include <QXmlStreamWriter>
+
+#include <KDebug>
+#include <KFilterDev>
+
+#include "dotcontrolflowgraph.h"
+#include "controlflowgraphdata.h"
+
+namespace {
+    QString dotString(const QString &value)
+    {
+        QString escaped(value);
+        escaped.replace('\\', "\\\\").replace('"', "\\\"");
+        return '"' + escaped + '"';
+    }
+
+    QString jsonString(const QString &value)
+    {
+        QString escaped;
+        escaped.reserve(value.size() + 2);
+        escaped += '"';
+        foreach (const QChar &c, value)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\' + QString(c);
+            else if (c.unicode() < 0x20)
+                escaped += QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0'));
+            else
+                escaped += c;
+        }
+        escaped += '"';
+        return escaped;
+    }
+}
+
+ControlFlowGraphWriter::ControlFlowGraphWriter(const ControlFlowGraphData &graphData)
+: m_graphData(graphData)
+{
+}
+
+ControlFlowGraphWriter::Format ControlFlowGraphWriter::format(const QString &fileName)
+{
+    QString name = fileName.toLower();
+    if (name.endsWith(".gz"))
+        name.chop(3);
+
+    if (name.endsWith(".dot"))
+        return FormatDot;
+    if (name.endsWith(".graphml"))
+        return FormatGraphML;
+    if (name.endsWith(".jsonl"))
+        return FormatJsonLines;
+    return FormatNone;
+}
+
+bool ControlFlowGraphWriter::canWrite(const QString &fileName)
+{
+    return format(fileName) != FormatNone;
+}
+
+bool ControlFlowGraphWriter::write(const QString &fileName)
+{
+    Format fileFormat = format(fileName);
+    if (fileFormat == FormatNone)
+        return false;
+
+    QIODevice *device;
+    if (fileName.endsWith(".gz", Qt::CaseInsensitive))
+        device = KFilterDev::deviceForFile(fileName, "application/x-gzip");
+    else
+        device = new QFile(fileName);
+    if (!device || !device->open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        kDebug() << "Could not open" << fileName << "for writing";
+        delete device;
+        return false;
+    }
+
+    // Nodes are grouped by cluster so that every cluster is written as a single block
+    int clusters = m_graphData.clusters().size();
+    m_childClusters = QVector<QVector<int> >(clusters + 1);
+    m_clusterNodes = QVector<QVector<int> >(clusters + 1);
+    for (int i = 0; i < clusters; ++i)
+    {
+        int parent = m_graphData.clusters()[i].parent;
+        m_childClusters[(parent == -1) ? clusters : parent].append(i);
+    }
+    for (int i = 0; i < m_graphData.nodes().size(); ++i)
+    {
+        int cluster = m_graphData.nodes()[i].cluster;
+        m_clusterNodes[(cluster == -1) ? clusters : cluster].append(i);
+    }
+
+    bool written;
+    if (fileFormat == FormatGraphML)
+        written = writeGraphML(device);
+    else
+    {
+        QTextStream stream(device);
+        stream.setCodec("UTF-8");
+        if (fileFormat == FormatDot)
+            writeDot(stream);
+        else
+            writeJsonLines(stream);
+        stream.flush();
+        written = stream.status() == QTextStream::Ok;
+    }
+
+    m_childClusters.clear();
+    m_clusterNodes.clear();
+    // Closing writes out what is still buffered, compressed files included
+    device->close();
+    QFile *file = qobject_cast<QFile *>(device);
+    if (file && file->error() != QFile::NoError)
+        written = false;
+    if (!written)
+        kDebug() << "Could not write" << fileName << ":" << device->errorString();
+    delete device;
+    return written;
+}
+
+void ControlFlowGraphWriter::writeDot(QTextStream &stream)
+{
+    stream << "digraph Root_Graph {\n";
+    writeDotCluster(stream, m_graphData.clusters().size(), 1);
+
+    foreach (const ControlFlowGraphData::Edge &edge, m_graphData.edges())
+        stream << "  " << ControlFlowGraphData::nodeName(edge.source) << " -> " << ControlFlowGraphData::nodeName(edge.target)
+               << " [id=" << dotString(ControlFlowGraphData::edgeName(edge.source, edge.target)) << "];\n";
+    stream << "}\n";
+}
+
+void ControlFlowGraphWriter::writeDotCluster(QTextStream &stream, int cluster, int depth)
+{
+    QString indent(2 * depth, ' ');
+    foreach (int childCluster, m_childClusters[cluster])
+    {
+        stream << indent << "subgraph cluster_" << childCluster << " {\n";
+        stream << indent << "  label=" << dotString(m_graphData.clusters()[childCluster].label) << ";\n";
+        writeDotCluster(stream, childCluster, depth + 1);
+        stream << indent << "}\n";
+    }
+
+    foreach (int node, m_clusterNodes[cluster])
+    {
+        const ControlFlowGraphData::Node &graphNode = m_graphData.nodes()[node];
+        stream << indent << ControlFlowGraphData::nodeName(node)
+               << " [label=" << dotString(graphNode.label)
+               << ", shape=box, style=filled, fillcolor=\"" << DotControlFlowGraph::nodeColor(graphNode.label).name() << "\"];\n";
+    }
+}
+
+bool ControlFlowGraphWriter::writeGraphML(QIODevice *device)
+{
+    QXmlStreamWriter writer(device);
+    writer.setAutoFormatting(true);
+    writer.writeStartDocument();
+    writer.writeStartElement("graphml");
+    writer.writeDefaultNamespace("http://graphml.graphdrawing.org/xmlns");
+
+    writer.writeStartElement("key");
+    writer.writeAttribute("id", "label");
+    writer.writeAttribute("for", "all");
+    writer.writeAttribute("attr.name", "label");
+    writer.writeAttribute("attr.type", "string");
+    writer.writeEndElement();
+    writer.writeStartElement("key");
+    writer.writeAttribute("id", "color");
+    writer.writeAttribute("for", "node");
+    writer.writeAttribute("attr.name", "color");
+    writer.writeAttribute("attr.type", "string");
+    writer.writeEndElement();
+
+    writer.writeStartElement("graph");
+    writer.writeAttribute("id", "Root_Graph");
+    writer.writeAttribute("edgedefault", "directed");
+    writeGraphMLCluster(writer, m_graphData.clusters().size());
+
+    // Edges may refer to nodes of nested graphs from the outermost one
+    foreach (const ControlFlowGraphData::Edge &edge, m_graphData.edges())
+    {
+        writer.writeStartElement("edge");
+        writer.writeAttribute("id", ControlFlowGraphData::edgeName(edge.source, edge.target));
+        writer.writeAttribute("source", ControlFlowGraphData::nodeName(edge.source));
+        writer.writeAttribute("target", ControlFlowGraphData::nodeName(edge.target));
+        writer.writeEndElement();
+    }
+
+    writer.writeEndElement();
+    writer.writeEndElement();
+    writer.writeEndDocument();
+    return !writer.hasError();
+}
+
+void ControlFlowGraphWriter::writeGraphMLCluster(QXmlStreamWriter &writer, int cluster)
+{
+    // Clusters are nodes holding a nested graph
+    foreach (int childCluster, m_childClusters[cluster])
+    {
+        QString id = "cluster_" + QString::number(childCluster);
+        writer.writeStartElement("node");
+        writer.writeAttribute("id", id);
+        writer.writeStartElement("data");
+        writer.writeAttribute("key", "label");
+        writer.writeCharacters(m_graphData.clusters()[childCluster].label);
+        writer.writeEndElement();
+        writer.writeStartElement("graph");
+        writer.writeAttribute("id", id + ':');
+        writer.writeAttribute("edgedefault", "directed");
+        writeGraphMLCluster(writer, childCluster);
+        writer.writeEndElement();
+        writer.writeEndElement();
+    }
+
+    foreach (int node, m_clusterNodes[cluster])
+    {
+        const ControlFlowGraphData::Node &graphNode = m_graphData.nodes()[node];
+        writer.writeStartElement("node");
+        writer.writeAttribute("id", ControlFlowGraphData::nodeName(node));
+        writer.writeStartElement("data");
+        writer.writeAttribute("key", "label");
+        writer.writeCharacters(graphNode.label);
+        writer.writeEndElement();
+        writer.writeStartElement("data");
+        writer.writeAttribute("key", "color");
+        writer.writeCharacters(DotControlFlowGraph::nodeColor(graphNode.label).name());
+        writer.writeEndElement();
+        writer.writeEndElement();
+    }
+}
+
+void ControlFlowGraphWriter::writeJsonLines(QTextStream &stream)
+{
+    // One self contained object per line, parents always precede their children
+    const QVector<ControlFlowGraphData::Cluster> &clusters = m_graphData.clusters();
+    for (int i = 0; i < clusters.size(); ++i)
+        stream << "{\"type\":\"cluster\",\"id\":" << i << ",\"parent\":" << clusters[i].parent
+               << ",\"label\":" << jsonString(clusters[i].label) << "}\n";
+
+    const QVector<ControlFlowGraphData::Node> &nodes = m_graphData.nodes();
+    for (int i = 0; i < nodes.size(); ++i)
+        stream << "{\"type\":\"node\",\"id\":" << i << ",\"cluster\":" << nodes[i].cluster
+               << ",\"label\":" << jsonString(nodes[i].label)
+               << ",\"color\":\"" << DotControlFlowGraph::nodeColor(nodes[i].label).name() << "\"}\n";
+
+    foreach (const ControlFlowGraphData::Edge &edge, m_graphData.edges())
+        stream << "{\"type\":\"edge\",\"source\":" << edge.source << ",\"target\":" << edge.target << ",\"calls\":" << edge.calls << "}\n";
+}
@@ -0,0 +1,57 @@
+/***************************************************************************
+ *   Copyright 2009 Sandro Andrade <sandroandrade@kde.org>                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CONTROLFLOWGRAPHWRITER_H
+#define CONTROLFLOWGRAPHWRITER_H
+
+#include <QString>
+#include <QVector>
+
+class QIODevice;
+class QTextStream;
+class QXmlStreamWriter;
+class ControlFlowGraphData;
+
+// Writes DOT, GraphML and JSON lines files straight from the graph data, one element at a
+// time through a buffered device, without building a graphviz graph. A .gz suffix compresses.
+class ControlFlowGraphWriter
+{
+public:
+    ControlFlowGraphWriter(const ControlFlowGraphData &graphData);
+
+    static bool canWrite(const QString &fileName);
+    bool write(const QString &fileName);
+private:
+    enum Format { FormatNone, FormatDot, FormatGraphML, FormatJsonLines };
+    static Format format(const QString &fileName);
+
+    void writeDot(QTextStream &stream);
+    void writeDotCluster(QTextStream &stream, int cluster, int depth);
+    // False if writing to device failed
+    bool writeGraphML(QIODevice *device);
+    void writeGraphMLCluster(QXmlStreamWriter &writer, int cluster);
+    void writeJsonLines(QTextStream &stream);
+
+    const ControlFlowGraphData &m_graphData;
+    // Children of each cluster, the last entry holds the ones placed in the root graph
+    QVector<QVector<int> > m_childClusters;
+    QVector<QVector<int> > m_clusterNodes;
+};
+
+#endif
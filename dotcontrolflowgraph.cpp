@@ -19,14 +19,25 @@
 
 #include "dotcontrolflowgraph.h"
 
-#include <cstdio>
+#include <QMap>
+#include <QFile>
+#include <QQueue>
+#include <QThread>
+
+#include <KLocale>
 
 #include <language/duchain/declaration.h>
 
+#include "controlflowgraphwriter.h"
+#include "controlflowgraphlayoutpool.h"
+#include "controlflowgraphlayoutthread.h"
+
 namespace {
     // C interface takes char*, so to avoid deprecated cast and/or undefined behaviour,
     // defined the needed constants here.
-    static char SUFFIX[] = "dot";
+    static char DOT[] = "dot";
+    static char NEATO[] = "neato";
+    static char SFDP[] = "sfdp";
     static char GRAPH_NAME[] = "Root_Graph";
     static char LABEL[] = "label";
     static char EMPTY[] = "";
@@ -35,160 +46,553 @@ namespace {
     static char SHAPE[] = "shape";
     static char STYLE[] = "style";
     static char BOX[] = "box";
+    static char SPLINES[] = "splines";
+    static char LINE[] = "line";
+    static char NSLIMIT[] = "nslimit";
+    static char NSLIMIT1[] = "nslimit1";
+    static char MCLIMIT[] = "mclimit";
+    static char SEARCHSIZE[] = "searchsize";
+    static char MAXITER[] = "maxiter";
+    static char BOX3D[] = "box3d";
+    static char PENWIDTH[] = "penwidth";
+    static char WEIGHT[] = "weight";
+    static char ID[] = "id";
+    static char ONE[] = "1";
+    static char FAST_NSLIMIT[] = "2";
+    static char FAST_MCLIMIT[] = "0.5";
+    static char FAST_SEARCHSIZE[] = "10";
+    static char FAST_MAXITER[] = "100";
+
+    // Graphs are written to the QByteArray given as agwrite channel, and never read back
+    int appendString(void *channel, const char *string)
+    {
+        static_cast<QByteArray *>(channel)->append(string);
+        return 0;
+    }
+
+    int flushNothing(void *channel)
+    {
+        Q_UNUSED(channel)
+        return 0;
+    }
+
+    Agiodisc_t BUFFER_IO_DISC = { 0, appendString, flushNothing };
+    Agdisc_t BUFFER_DISC = { &AgMemDisc, &AgIdDisc, &BUFFER_IO_DISC };
 }
 
 QMutex DotControlFlowGraph::mutex;
 
-DotControlFlowGraph::DotControlFlowGraph() : m_rootGraph(0)
+DotControlFlowGraph::DotControlFlowGraph()
+: m_layoutThread(new ControlFlowGraphLayoutThread(this)),
+  m_shownGraph(0),
+  m_shownGeneration(0),
+  m_layoutEngine(LayoutBySize),
+  m_fastLayoutNodes(500),
+  m_sfdpNodes(2000),
+  m_nodeBudget(300)
 {
-    m_gvc = gvContext();
+    // Created here, it reads its limits from the configuration on the GUI thread
+    ControlFlowGraphLayoutPool::self();
+    qRegisterMetaType<ControlFlowGraphData>("ControlFlowGraphData");
+    connect(m_layoutThread, SIGNAL(layoutReady()), SLOT(loadLayout()), Qt::QueuedConnection);
 }
 
 DotControlFlowGraph::~DotControlFlowGraph()
 {
-    gvFreeContext(m_gvc);
+    delete m_layoutThread;
+    if (m_shownGraph)
+        closeGraph(m_shownGraph);
 }
 
-void DotControlFlowGraph::graphDone()
+ControlFlowGraphData *DotControlFlowGraph::graphData()
 {
-    if (m_rootGraph)
+    return &m_graphData;
+}
+
+void DotControlFlowGraph::copyGraph(const DotControlFlowGraph *other)
+{
+    m_graphData = other->m_graphData;
+    m_expandedClusters = other->m_expandedClusters;
+    m_layoutEngine = other->m_layoutEngine;
+    m_fastLayoutNodes = other->m_fastLayoutNodes;
+    m_sfdpNodes = other->m_sfdpNodes;
+    m_nodeBudget = other->m_nodeBudget;
+    m_exportLayout.clear();
+    if (other->m_shownGeneration == other->m_layoutThread->generation())
+        m_exportLayout = other->m_shownLayout;
+}
+
+void DotControlFlowGraph::setLayoutEngine(LayoutEngine layoutEngine)
+{
+    m_layoutEngine = layoutEngine;
+}
+
+void DotControlFlowGraph::setLayoutThresholds(int fastLayoutNodes, int sfdpNodes)
+{
+    m_fastLayoutNodes = fastLayoutNodes;
+    m_sfdpNodes = sfdpNodes;
+}
+
+bool DotControlFlowGraph::isFastLayout(const ControlFlowGraphData &graphData) const
+{
+    return visibleNodeCount(graphData) >= m_fastLayoutNodes;
+}
+
+void DotControlFlowGraph::setNodeBudget(int nodeBudget)
+{
+    m_nodeBudget = nodeBudget;
+}
+
+bool DotControlFlowGraph::isCollapsedClusterName(const QString &name)
+{
+    return name.startsWith('c');
+}
+
+int DotControlFlowGraph::visibleNodeCount(const ControlFlowGraphData &graphData) const
+{
+    // Collapsing stops close to the budget, only expanded clusters go beyond it
+    return (m_nodeBudget > 0) ? qMin(graphData.nodes().size(), m_nodeBudget) : graphData.nodes().size();
+}
+
+QVector<int> DotControlFlowGraph::collapsedClusters(const ControlFlowGraphData &graphData, const QSet<int> &expandedClusters) const
+{
+    // For each cluster, the outermost collapsed cluster containing it, or -1 if its members are shown
+    const QVector<ControlFlowGraphData::Cluster> &clusters = graphData.clusters();
+    if (m_nodeBudget <= 0 || graphData.nodes().size() <= m_nodeBudget)
+        return QVector<int>();
+
+    QVector<QVector<int> > childClusters(clusters.size());
+    QVector<int> clusterNodes(clusters.size(), 0);
+    QQueue<int> pendingClusters;
+    int visible = 0;
+    for (int i = 0; i < clusters.size(); ++i)
     {
-        if (mutex.tryLock())
+        if (clusters[i].parent == -1)
         {
-            gvLayout(m_gvc, m_rootGraph, SUFFIX);
-            gvFreeLayout(m_gvc, m_rootGraph);
-            mutex.unlock();
-            emit loadLibrary(m_rootGraph);
+            pendingClusters.enqueue(i);
+            ++visible;
         }
+        else
+            childClusters[clusters[i].parent].append(i);
     }
+    foreach (const ControlFlowGraphData::Node &node, graphData.nodes())
+    {
+        if (node.cluster == -1)
+            ++visible;
+        else
+            ++clusterNodes[node.cluster];
+    }
+
+    // Outer clusters are expanded first, breadth first, as long as their members fit in the budget
+    QVector<bool> expanded(clusters.size(), false);
+    while (!pendingClusters.isEmpty())
+    {
+        int cluster = pendingClusters.dequeue();
+        int cost = clusterNodes[cluster] + childClusters[cluster].size() - 1;
+        if (visible + cost > m_nodeBudget && !expandedClusters.contains(cluster))
+            continue;
+
+        expanded[cluster] = true;
+        visible += cost;
+        foreach (int childCluster, childClusters[cluster])
+            pendingClusters.enqueue(childCluster);
+    }
+
+    // Parents precede their children, so one pass finds the outermost collapsed cluster
+    QVector<int> collapsed(clusters.size(), -1);
+    for (int i = 0; i < clusters.size(); ++i)
+    {
+        int parent = clusters[i].parent;
+        if (parent != -1 && collapsed[parent] != -1)
+            collapsed[i] = collapsed[parent];
+        else if (!expanded[i])
+            collapsed[i] = i;
+    }
+    return collapsed;
 }
 
-void DotControlFlowGraph::clearGraph()
+char *DotControlFlowGraph::layoutEngine(const ControlFlowGraphData &graphData) const
 {
-    if (m_rootGraph)
+    switch (m_layoutEngine)
     {
-        gvFreeLayout(m_gvc, m_rootGraph);
-        agclose(m_rootGraph);
-        m_rootGraph = 0;
+        case LayoutDot:   return DOT;
+        case LayoutNeato: return NEATO;
+        case LayoutSfdp:  return SFDP;
+        default:
+            break;
     }
 
-    m_namedGraphs.clear();
-    m_rootGraph = agopen(GRAPH_NAME, Agdirected, NULL);
+    // dot ranks and orders every node, which gets very slow for thousands of them
+    int nodes = visibleNodeCount(graphData);
+    if (nodes >= m_sfdpNodes)
+        return SFDP;
+    if (nodes >= m_fastLayoutNodes)
+        return NEATO;
+    return DOT;
+}
+
+QByteArray DotControlFlowGraph::shownLayout(QSet<int> *expandedClusters) const
+{
+    if (m_shownGeneration != m_layoutThread->generation())
+        return QByteArray();
+    if (expandedClusters)
+        *expandedClusters = m_expandedClusters;
+    return m_shownLayout;
+}
+
+bool DotControlFlowGraph::showLayout(const QSet<int> &expandedClusters, const QByteArray &layout)
+{
+    Agraph_t *rootGraph = readGraph(layout);
+    if (!rootGraph)
+        return false;
+
+    // Layouts still running for the previous graph are dropped by loadLayout()
+    m_expandedClusters = expandedClusters;
+    emit loadLibrary(rootGraph);
+    if (m_shownGraph)
+        closeGraph(m_shownGraph);
+    m_shownGraph = rootGraph;
+    m_shownLayout = layout;
+    m_shownGeneration = m_layoutThread->skipLayout();
+    return true;
+}
+
+void DotControlFlowGraph::updateGraph(const ControlFlowGraphData &graphData, const QVector<int> &clusterMap)
+{
+    m_graphData = graphData;
+
+    // Expanded clusters stay expanded, unless the update dropped them
+    QSet<int> expandedClusters;
+    foreach (int cluster, m_expandedClusters)
+        if (clusterMap.value(cluster, -1) != -1)
+            expandedClusters.insert(clusterMap[cluster]);
+    m_expandedClusters = expandedClusters;
+    graphDone();
+}
+
+void DotControlFlowGraph::showGraph(const ControlFlowGraphData &graphData)
+{
+    m_graphData = graphData;
+    graphDone();
+}
+
+void DotControlFlowGraph::graphDone()
+{
+    // Graphs nobody shows, like the ones being exported, are not laid out
+    if (receivers(SIGNAL(loadLibrary(graph_t*))) > 0)
+        m_layoutThread->layout(m_graphData, m_expandedClusters);
+}
+
+void DotControlFlowGraph::expandCluster(const QString &name)
+{
+    bool ok = false;
+    int cluster = isCollapsedClusterName(name) ? name.mid(1).toInt(&ok) : -1;
+    if (!ok || cluster < 0 || cluster >= m_graphData.clusters().size())
+        return;
+
+    // Its parents were expanded already, since it was shown
+    m_expandedClusters.insert(cluster);
     graphDone();
 }
 
-void DotControlFlowGraph::exportGraph(const QString &fileName)
+void DotControlFlowGraph::collapseClusters()
 {
-    if (m_rootGraph)
+    m_expandedClusters.clear();
+}
+
+void DotControlFlowGraph::loadLayout()
+{
+    int generation;
+    QByteArray layout;
+    Agraph_t *rootGraph = m_layoutThread->takeLayout(&generation, &layout);
+    if (!rootGraph)
+        return;
+    if (generation <= m_shownGeneration)
     {
-        gvLayout(m_gvc, m_rootGraph, SUFFIX);
-        gvRenderFilename(m_gvc, m_rootGraph, fileName.right(fileName.size()-fileName.lastIndexOf('.')-1).toUtf8().data(), fileName.toUtf8().data());
-        gvFreeLayout(m_gvc, m_rootGraph);
+        closeGraph(rootGraph);
+        return;
     }
+
+    // Positions come with the graph, so the view only has to draw it
+    emit loadLibrary(rootGraph);
+    if (m_shownGraph)
+        closeGraph(m_shownGraph);
+    m_shownGraph = rootGraph;
+    m_shownLayout = layout;
+    m_shownGeneration = generation;
 }
 
-void DotControlFlowGraph::prepareNewGraph()
+void DotControlFlowGraph::clearGraph()
 {
-    clearGraph();
+    m_graphData.clear();
+    m_expandedClusters.clear();
+    graphDone();
 }
 
-void DotControlFlowGraph::foundRootNode(const QStringList &containers, const QString &label)
+ControlFlowGraphRenderCache::Hit DotControlFlowGraph::exportGraph(const QStringList &fileNames, ControlFlowGraphRenderCache *renderCache)
 {
-    Agraph_t *graph = m_rootGraph;
-    if (!m_rootGraph) {
-        // This shouldn't happen, as the graph should be generated before this function
-        // is connected.
-        Q_ASSERT(false);
-        return;
+    if (renderCache && !renderCache->isEnabled())
+        renderCache = 0;
+
+    // DOT, GraphML and JSON lines are streamed from the graph data, without a layout
+    QStringList layoutFileNames;
+    foreach (const QString &fileName, fileNames)
+    {
+        if (ControlFlowGraphWriter::canWrite(fileName))
+        {
+            if (!ControlFlowGraphWriter(m_graphData).write(fileName))
+                return ControlFlowGraphRenderCache::Failed;
+        }
+        else
+            layoutFileNames.append(fileName);
     }
-    QString absoluteContainer;
-    foreach (const QString& container, containers)
+    if (layoutFileNames.isEmpty())
+        return ControlFlowGraphRenderCache::Streamed;
+
+    char *engine = layoutEngine(m_graphData);
+    QByteArray key;
+    if (renderCache)
     {
-        absoluteContainer += container;
-        graph = m_namedGraphs[absoluteContainer] = agsubg(graph, ("cluster_" + absoluteContainer).toUtf8().data(), 1);
-        agsafeset(graph, LABEL, container.toUtf8().data(), EMPTY);
+        // Clusters expanded by the user are drawn, and laid out, differently
+        QList<int> expandedClusters = m_expandedClusters.toList();
+        qSort(expandedClusters);
+        QByteArray layoutOptions = QByteArray(engine) + (isFastLayout(m_graphData) ? " fast" : "") +
+                                   " budget " + QByteArray::number(m_nodeBudget) + " expanded";
+        foreach (int cluster, expandedClusters)
+            layoutOptions += ' ' + QByteArray::number(cluster);
+        key = ControlFlowGraphRenderCache::graphKey(m_graphData, layoutOptions);
     }
 
-    Agnode_t *node = agnode(graph, (containers.join("") + label).toUtf8().data(), 1);
-    agsafeset(node, SHAPE, BOX, EMPTY);
-    QColor c = colorFromQualifiedIdentifier(label);
-    char color[8];
-    std::sprintf (color, "#%02x%02x%02x", c.red(), c.green(), c.blue());
-    agsafeset(node, STYLE, FILLED, EMPTY);
-    agsafeset(node, FILLCOLOR, color, EMPTY);
-    agsafeset(node, LABEL, label.toUtf8().data(), EMPTY);
+    // Identical exports are copied, graphviz is not involved at all
+    QStringList renderFileNames;
+    foreach (const QString &fileName, layoutFileNames)
+    {
+        if (renderCache)
+        {
+            QString renderPath = renderCache->renderPath(key, fileFormat(fileName));
+            if (renderCache->lookup(renderPath))
+            {
+                QFile::remove(fileName);
+                if (QFile::copy(renderPath, fileName))
+                    continue;
+            }
+        }
+        renderFileNames.append(fileName);
+    }
+    if (renderFileNames.isEmpty())
+        return ControlFlowGraphRenderCache::RenderHit;
+
+    // Every remaining format is rendered from a single layout: one copied along with the graph, the one
+    // shown by the view if it is still current, a cached one, or a new one
+    ControlFlowGraphRenderCache::Hit hit = ControlFlowGraphRenderCache::LayoutHit;
+    QByteArray layout;
+    if (!m_exportLayout.isEmpty())
+        layout = m_exportLayout;
+    else if (!m_shownLayout.isEmpty() && QThread::currentThread() == thread() && m_shownGeneration == m_layoutThread->generation())
+        layout = m_shownLayout;
+    else if (renderCache && renderCache->lookup(renderCache->layoutPath(key)))
+    {
+        QFile layoutFile(renderCache->layoutPath(key));
+        if (layoutFile.open(QIODevice::ReadOnly))
+            layout = layoutFile.readAll();
+    }
+
+    ControlFlowGraphLayoutPool *layoutPool = ControlFlowGraphLayoutPool::self();
+    if (layout.isEmpty())
+    {
+        hit = ControlFlowGraphRenderCache::Miss;
+        layout = layoutPool->layout(graphSource(m_graphData, m_expandedClusters), engine);
+        if (layout.isEmpty())
+            return ControlFlowGraphRenderCache::Failed;
+        if (renderCache)
+            renderCache->store(renderCache->layoutPath(key), layout);
+    }
+
+    if (!layoutPool->render(layout, renderFileNames))
+        return ControlFlowGraphRenderCache::Failed;
+
+    foreach (const QString &fileName, renderFileNames)
+    {
+        if (renderCache)
+        {
+            QFile renderFile(fileName);
+            if (renderFile.open(QIODevice::ReadOnly))
+                renderCache->store(renderCache->renderPath(key, fileFormat(fileName)), renderFile.readAll());
+        }
+    }
+
+    return hit;
 }
 
-void DotControlFlowGraph::foundFunctionCall(const QStringList &sourceContainers, const QString &source, const QStringList &targetContainers, const QString &target)
+QByteArray DotControlFlowGraph::writeGraph(Agraph_t *rootGraph)
 {
-    if (!m_rootGraph) {
-        // This shouldn't happen, as the graph should be generated before this function
-        // is connected.
-        Q_ASSERT(false);
-        return;
+    QByteArray source;
+    agwrite(rootGraph, &source);
+    return source;
+}
+
+QByteArray DotControlFlowGraph::graphSource(const ControlFlowGraphData &graphData, const QSet<int> &expandedClusters)
+{
+    QMutexLocker locker(&mutex);
+    Agraph_t *rootGraph = buildGraph(graphData, expandedClusters);
+    QByteArray source = writeGraph(rootGraph);
+    agclose(rootGraph);
+    return source;
+}
+
+Agraph_t *DotControlFlowGraph::readGraph(const QByteArray &layout)
+{
+    QMutexLocker locker(&mutex);
+    return agmemread(layout.constData());
+}
+
+void DotControlFlowGraph::closeGraph(Agraph_t *rootGraph)
+{
+    QMutexLocker locker(&mutex);
+    agclose(rootGraph);
+}
+
+QString DotControlFlowGraph::fileFormat(const QString &fileName)
+{
+    return fileName.right(fileName.size()-fileName.lastIndexOf('.')-1);
+}
+
+void DotControlFlowGraph::prepareNewGraph()
+{
+    clearGraph();
+}
+
+Agraph_t *DotControlFlowGraph::buildGraph(const ControlFlowGraphData &graphData, const QSet<int> &expandedClusters)
+{
+    Agraph_t *rootGraph = agopen(GRAPH_NAME, Agdirected, &BUFFER_DISC);
+
+    // Straight edges and bounded crossing minimization and iterations, in whichever engine lays it out
+    if (isFastLayout(graphData))
+    {
+        agsafeset(rootGraph, SPLINES, LINE, EMPTY);
+        agsafeset(rootGraph, NSLIMIT, FAST_NSLIMIT, EMPTY);
+        agsafeset(rootGraph, NSLIMIT1, FAST_NSLIMIT, EMPTY);
+        agsafeset(rootGraph, MCLIMIT, FAST_MCLIMIT, EMPTY);
+        agsafeset(rootGraph, SEARCHSIZE, FAST_SEARCHSIZE, EMPTY);
+        agsafeset(rootGraph, MAXITER, FAST_MAXITER, EMPTY);
     }
-    Agraph_t *sourceGraph, *targetGraph, *newGraph;
-    sourceGraph = targetGraph = m_rootGraph;
-    QString absoluteContainer;
 
-    foreach (const QString& container, sourceContainers)
+    // Attributes are declared once, with the values most elements share as defaults, and set
+    // through their symbols on creation
+    Agsym_t *clusterLabel = agattr(rootGraph, AGRAPH, LABEL, EMPTY);
+    agattr(rootGraph, AGNODE, STYLE, FILLED);
+    Agsym_t *nodeShape = agattr(rootGraph, AGNODE, SHAPE, BOX);
+    Agsym_t *nodeFillColor = agattr(rootGraph, AGNODE, FILLCOLOR, EMPTY);
+    Agsym_t *nodeLabel = agattr(rootGraph, AGNODE, LABEL, EMPTY);
+    Agsym_t *edgeId = agattr(rootGraph, AGEDGE, ID, EMPTY);
+    // Colors only depend on the first label component, which many nodes share
+    QHash<QString, QByteArray> colors;
+
+    // Clusters are interned parent first, so a parent subgraph always exists when its children are created
+    const QVector<ControlFlowGraphData::Cluster> &clusters = graphData.clusters();
+    const QVector<ControlFlowGraphData::Node> &nodes = graphData.nodes();
+    QVector<int> collapsed = collapsedClusters(graphData, expandedClusters);
+    QVector<Agraph_t *> clusterGraphs(clusters.size());
+    QVector<Agnode_t *> clusterNodes(clusters.size());
+    QVector<int> clusterSizes(collapsed.isEmpty() ? 0 : clusters.size(), 0);
+    if (!collapsed.isEmpty())
+        foreach (const ControlFlowGraphData::Node &node, nodes)
+            for (int cluster = node.cluster; cluster != -1; cluster = clusters[cluster].parent)
+                ++clusterSizes[cluster];
+    for (int i = 0; i < clusters.size(); ++i)
     {
-        Agraph_t *previousGraph = sourceGraph;
-        absoluteContainer += container;
-        if (!m_namedGraphs.contains(absoluteContainer))
+        Agraph_t *parentGraph = (clusters[i].parent == -1) ? rootGraph : clusterGraphs[clusters[i].parent];
+        if (!collapsed.isEmpty() && collapsed[i] != -1)
         {
-            newGraph = agsubg(previousGraph, ("cluster_" + absoluteContainer).toUtf8().data(), 1);
-            m_namedGraphs.insert(absoluteContainer, newGraph);
-            agsafeset(newGraph, LABEL, container.toUtf8().data(), EMPTY);
+            if (collapsed[i] != i)
+                continue;
+
+            // A collapsed cluster is drawn as one node, named after the cluster index
+            Agnode_t *node = clusterNodes[i] = agnode(parentGraph, ('c' + QByteArray::number(i)).data(), 1);
+            QByteArray &color = colors[colorScope(clusters[i].label)];
+            if (color.isEmpty())
+                color = nodeColor(clusters[i].label).name().toLatin1();
+            agxset(node, nodeShape, BOX3D);
+            agxset(node, nodeFillColor, color.data());
+            agxset(node, nodeLabel, i18np("%2\n(1 function)", "%2\n(%1 functions)", clusterSizes[i], clusters[i].label).toUtf8().data());
+            continue;
         }
-        sourceGraph = m_namedGraphs[absoluteContainer];
+        clusterGraphs[i] = agsubg(parentGraph, ("cluster_" + QByteArray::number(i)).data(), 1);
+        agxset(clusterGraphs[i], clusterLabel, clusters[i].label.toUtf8().data());
     }
-    absoluteContainer.clear();
-    foreach (const QString& container, targetContainers)
+
+    QVector<Agnode_t *> graphNodes(nodes.size());
+    // Node index, or the number of nodes plus the cluster index for collapsed cluster members
+    QVector<int> graphNodeIds(nodes.size());
+    for (int i = 0; i < nodes.size(); ++i)
     {
-        Agraph_t *previousGraph = targetGraph;
-        absoluteContainer += container;
-        if (!m_namedGraphs.contains(absoluteContainer))
+        if (!collapsed.isEmpty() && nodes[i].cluster != -1 && collapsed[nodes[i].cluster] != -1)
         {
-            Agraph_t *newGraph = agsubg(previousGraph, ("cluster_" + absoluteContainer).toUtf8().data(), 1);
-            m_namedGraphs.insert(absoluteContainer, newGraph);
-            agsafeset(newGraph, LABEL, container.toUtf8().data(), EMPTY);
+            graphNodes[i] = clusterNodes[collapsed[nodes[i].cluster]];
+            graphNodeIds[i] = nodes.size() + collapsed[nodes[i].cluster];
+            continue;
         }
-        targetGraph = m_namedGraphs[absoluteContainer];
+        graphNodeIds[i] = i;
+
+        Agraph_t *graph = (nodes[i].cluster == -1) ? rootGraph : clusterGraphs[nodes[i].cluster];
+        Agnode_t *node = graphNodes[i] = agnode(graph, ('n' + QByteArray::number(i)).data(), 1);
+
+        QByteArray &color = colors[colorScope(nodes[i].label)];
+        if (color.isEmpty())
+            color = nodeColor(nodes[i].label).name().toLatin1();
+        agxset(node, nodeFillColor, color.data());
+        agxset(node, nodeLabel, nodes[i].label.toUtf8().data());
     }
 
-    Agnode_t* src = agnode(sourceGraph, (sourceContainers.join("") + source).toUtf8().data(), 1);
-    Agnode_t* tgt = agnode(targetGraph, (targetContainers.join("") + target).toUtf8().data(), 1);
+    // Edges from or to collapsed clusters are merged, weighted by their number of call sites.
+    // They are added in id order, so the same graph is always written the same way
+    QMap<QPair<int, int>, int> mergedEdges;
+    foreach (const ControlFlowGraphData::Edge &edge, graphData.edges())
+    {
+        if (!collapsed.isEmpty() &&
+            ((nodes[edge.source].cluster != -1 && collapsed[nodes[edge.source].cluster] != -1) ||
+             (nodes[edge.target].cluster != -1 && collapsed[nodes[edge.target].cluster] != -1)))
+        {
+            if (graphNodes[edge.source] != graphNodes[edge.target])
+                mergedEdges[qMakePair(graphNodeIds[edge.source], graphNodeIds[edge.target])] += edge.calls;
+            continue;
+        }
+
+        int sourceCluster = nodes[edge.source].cluster;
+        Agraph_t *graph = (sourceCluster != -1 && sourceCluster == nodes[edge.target].cluster) ? clusterGraphs[sourceCluster] : rootGraph;
+        Agedge_t *graphEdge = agedge(graph, graphNodes[edge.source], graphNodes[edge.target], NULL, 1);
+        agxset(graphEdge, edgeId, ControlFlowGraphData::edgeName(edge.source, edge.target).toUtf8().data());
+    }
 
-    char color[8];
-    char ID[] = "id";
+    if (mergedEdges.isEmpty())
+        return rootGraph;
 
-    QColor c = colorFromQualifiedIdentifier(source);
-    std::sprintf (color, "#%02x%02x%02x", c.red(), c.green(), c.blue());
-    agsafeset(src, STYLE, FILLED, EMPTY);
-    agsafeset(src, FILLCOLOR, color, EMPTY);
-    agsafeset(src, SHAPE, BOX, EMPTY);
-    agsafeset(src, LABEL, source.toUtf8().data(), EMPTY);
+    Agsym_t *edgeLabel = agattr(rootGraph, AGEDGE, LABEL, EMPTY);
+    Agsym_t *edgeWeight = agattr(rootGraph, AGEDGE, WEIGHT, ONE);
+    Agsym_t *edgePenWidth = agattr(rootGraph, AGEDGE, PENWIDTH, ONE);
+    for (QMap<QPair<int, int>, int>::const_iterator it = mergedEdges.constBegin(); it != mergedEdges.constEnd(); ++it)
+    {
+        Agnode_t *source = (it.key().first < nodes.size()) ? graphNodes[it.key().first] : clusterNodes[it.key().first - nodes.size()];
+        Agnode_t *target = (it.key().second < nodes.size()) ? graphNodes[it.key().second] : clusterNodes[it.key().second - nodes.size()];
+        Agedge_t *graphEdge = agedge(rootGraph, source, target, NULL, 1);
+        QByteArray calls = QByteArray::number(it.value());
+        QByteArray penWidth = QByteArray::number(qMin(1 + it.value() / 4, 6));
+        agxset(graphEdge, edgeLabel, calls.data());
+        agxset(graphEdge, edgeWeight, calls.data());
+        agxset(graphEdge, edgePenWidth, penWidth.data());
+    }
 
-    c = colorFromQualifiedIdentifier(target);
-    std::sprintf (color, "#%02x%02x%02x", c.red(), c.green(), c.blue());
-    agsafeset(tgt, STYLE, FILLED, EMPTY);
-    agsafeset(tgt, FILLCOLOR, color, EMPTY);
-    agsafeset(tgt, SHAPE, BOX, EMPTY);
-    agsafeset(tgt, LABEL, target.toUtf8().data(), EMPTY);
+    return rootGraph;
+}
 
-    Agedge_t* edge;
-    if (sourceGraph == targetGraph)
-        edge = agedge(sourceGraph, src, tgt, NULL, 1);
-    else
-        edge = agedge(m_rootGraph, src, tgt, NULL, 1);
-    agsafeset(edge, ID, (source + "->" + target).toUtf8().data(), EMPTY);
+QColor DotControlFlowGraph::nodeColor(const QString &label)
+{
+    // Derived from the name, so the same graph is always drawn, and cached, with the same colors
+    return QColor::fromHsv(qHash(colorScope(label)) % 256, 255, 190);
 }
 
-const QColor& DotControlFlowGraph::colorFromQualifiedIdentifier(const QString &label)
+QString DotControlFlowGraph::colorScope(const QString &label)
 {
-    if (m_colorMap.contains(label.split("::")[0]))
-        return m_colorMap[label.split("::")[0]];
-    else
-        return m_colorMap[label.split("::")[0]] = QColor::fromHsv(qrand() % 256, 255, 190);
+    // Whole label when it has no scope
+    return label.left(label.indexOf("::"));
 }
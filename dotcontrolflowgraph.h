@@ -20,19 +20,19 @@
 #ifndef DOTCONTROLFLOWGRAPH_H
 #define DOTCONTROLFLOWGRAPH_H
 
-#include <QMap>
-#include <QHash>
+#include <QSet>
 #include <QColor>
 #include <QMutex>
+#include <QStringList>
 #include <QObject>
 
+// Only for the graph_t of the KGraphViewer part, gvc itself is not linked
 #include <graphviz/gvc.h>
 
-namespace KDevelop {
-    class QualifiedIdentifier;
-}
-using namespace KDevelop;
+#include "controlflowgraphdata.h"
+#include "controlflowgraphrendercache.h"
 
+class ControlFlowGraphLayoutThread;
 
 class DotControlFlowGraph : public QObject
 {
@@ -40,22 +40,76 @@ class DotControlFlowGraph : public QObject
 public:
     DotControlFlowGraph();
     virtual ~DotControlFlowGraph();
+    // Serializes cgraph, which keeps global state while building, parsing, writing and closing graphs
     static QMutex mutex;
+
+    ControlFlowGraphData *graphData();
+    // Takes the graph data and settings of other, along with its shown layout if still current, for exporting
+    void copyGraph(const DotControlFlowGraph *other);
+    // The shown layout and the clusters it was made with, empty if the graph changed since it was laid out
+    QByteArray shownLayout(QSet<int> *expandedClusters = 0) const;
+    // Shows the current graph data with a layout made for it earlier instead of laying it out again
+    bool showLayout(const QSet<int> &expandedClusters, const QByteArray &layout);
+    // Shows graphData patched from the current graph, clusterMap gives the new index of each current cluster
+    void updateGraph(const ControlFlowGraphData &graphData, const QVector<int> &clusterMap);
+    // The caller holds mutex until it has closed the returned graph
+    Agraph_t *buildGraph(const ControlFlowGraphData &graphData, const QSet<int> &expandedClusters);
+    // Dot source of a graph from buildGraph, as fed to the layout workers. The caller holds mutex
+    static QByteArray writeGraph(Agraph_t *rootGraph);
+    // Dot source of graphData, built, written and closed under mutex
+    QByteArray graphSource(const ControlFlowGraphData &graphData, const QSet<int> &expandedClusters);
+    // Parses a laid out graph, to be closed with closeGraph
+    static Agraph_t *readGraph(const QByteArray &layout);
+    static void closeGraph(Agraph_t *rootGraph);
+
+    // Graphs with more nodes collapse clusters into single nodes until they fit, 0 disables it
+    void setNodeBudget(int nodeBudget);
+    static bool isCollapsedClusterName(const QString &name);
+
+    enum LayoutEngine { LayoutBySize, LayoutDot, LayoutNeato, LayoutSfdp };
+    void setLayoutEngine(LayoutEngine layoutEngine);
+    // From fastLayoutNodes nodes on graphs get fast layout attributes and, chosen by size, neato. From sfdpNodes on sfdp
+    void setLayoutThresholds(int fastLayoutNodes, int sfdpNodes);
+    char *layoutEngine(const ControlFlowGraphData &graphData) const;
+    bool isFastLayout(const ControlFlowGraphData &graphData) const;
+    // Fill color of a node, derived from the first component of its label
+    static QColor nodeColor(const QString &label);
+    static QString colorScope(const QString &label);
 Q_SIGNALS:
     bool loadLibrary(graph_t *rootGraph);
 public Q_SLOTS:
     void prepareNewGraph();
-    void foundRootNode (const QStringList &containers, const QString &label);
-    void foundFunctionCall (const QStringList &sourceContainers, const QString &source, const QStringList &targetContainers, const QString &target);
+    // Queues the current graph data for layout. GUI thread only, like everything changing the graph data
     void graphDone();
+    // Shows a graph being generated, its clusters keep their index as it grows
+    void showGraph(const ControlFlowGraphData &graphData);
     void clearGraph();
-    void exportGraph(const QString &fileName);
+    // Shows the members of a collapsed cluster, given its node name
+    void expandCluster(const QString &name);
+    void collapseClusters();
+    // Renders the graph to every file, in the format given by its extension, laying it out at most once
+    ControlFlowGraphRenderCache::Hit exportGraph(const QStringList &fileNames, ControlFlowGraphRenderCache *renderCache = 0);
+private Q_SLOTS:
+    void loadLayout();
 private:
-    GVC_t *m_gvc;
-    Agraph_t *m_rootGraph;
-    QMap<QString, QColor> m_colorMap;
-    QHash<QString, Agraph_t *> m_namedGraphs;
-    const QColor& colorFromQualifiedIdentifier(const QString &label);
+    static QString fileFormat(const QString &fileName);
+    int visibleNodeCount(const ControlFlowGraphData &graphData) const;
+    QVector<int> collapsedClusters(const ControlFlowGraphData &graphData, const QSet<int> &expandedClusters) const;
+
+    ControlFlowGraphLayoutThread *m_layoutThread;
+    // Front buffer, the layout the view has loaded last, parsed and as written by the worker
+    Agraph_t *m_shownGraph;
+    QByteArray m_shownLayout;
+    int m_shownGeneration;
+    // Layout copied from another graph, rendered by exportGraph before anything else
+    QByteArray m_exportLayout;
+    ControlFlowGraphData m_graphData;
+    LayoutEngine m_layoutEngine;
+    int m_fastLayoutNodes;
+    int m_sfdpNodes;
+    int m_nodeBudget;
+    // Clusters expanded by the user, kept expanded whatever the node budget
+    QSet<int> m_expandedClusters;
 };
 
 #endif
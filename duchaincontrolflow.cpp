@@ -19,14 +19,17 @@
 
 #include "duchaincontrolflow.h"
 
-#include <limits>
+#include <QTimer>
 
 #include <KLocale>
+#include <KDebug>
 
 #include <KTextEditor/View>
 #include <KTextEditor/Document>
 #include <KTextEditor/Cursor>
 
+#include <ThreadWeaver/Weaver>
+
 #include <interfaces/icore.h>
 #include <interfaces/iproject.h>
 #include <interfaces/iruncontroller.h>
@@ -34,145 +37,189 @@
 #include <interfaces/ilanguagecontroller.h>
 #include <interfaces/idocumentcontroller.h>
 
-#include <language/duchain/use.h>
 #include <language/duchain/duchain.h>
 #include <language/duchain/ducontext.h>
 #include <language/duchain/declaration.h>
+#include <language/duchain/topducontext.h>
 #include <language/duchain/duchainlock.h>
 #include <language/duchain/duchainutils.h>
 #include <language/duchain/indexedstring.h>
 #include <language/util/navigationtooltip.h>
 #include <language/duchain/functiondefinition.h>
-#include <language/duchain/types/functiontype.h>
 #include <language/backgroundparser/backgroundparser.h>
 
-#include <project/projectmodel.h>
-#include <project/interfaces/ibuildsystemmanager.h>
-
 #include "dotcontrolflowgraph.h"
+#include "controlflowgraphdata.h"
+#include "controlflowgraphedgeuses.h"
+#include "controlflowgraphlocationresolver.h"
 #include "duchaincontrolflowjob.h"
-#include "controlflowgraphusescollector.h"
+#include "controlflowgraphprefetchjob.h"
 #include "controlflowgraphnavigationwidget.h"
 
-Q_DECLARE_METATYPE(KDevelop::Use)
-
 using namespace KDevelop;
 
+// Total nodes and edges kept by the interactive graph cache
+static const int GRAPH_CACHE_COST = 20000;
+// Partial graphs are shown at most this often, in milliseconds, while a new graph is generated
+static const int SNAPSHOT_INTERVAL = 250;
+// Cursor moves closer together than this, in milliseconds, generate a single graph
+static const int CURSOR_DEBOUNCE_INTERVAL = 150;
+// Most direct callees of the shown function whose graphs are prefetched
+static const int PREFETCH_CALLEES = 4;
+
+bool DUChainControlFlow::GraphKey::operator==(const GraphKey &other) const
+{
+    return context == other.context && settings == other.settings;
+}
+
+uint qHash(const DUChainControlFlow::GraphKey &key)
+{
+    return qHash(key.context) ^ qHash(key.settings);
+}
+
 DUChainControlFlow::DUChainControlFlow(DotControlFlowGraph* dotControlFlowGraph)
-: m_dotControlFlowGraph(dotControlFlowGraph),
+: ControlFlowGraphTraversal(dotControlFlowGraph->graphData()),
+  m_dotControlFlowGraph(dotControlFlowGraph),
   m_previousUppermostExecutableContext(IndexedDUContext()),
   m_currentView(0),
-  m_currentProject(0),
-  m_currentLevel(1),
-  m_maxLevel(2),
+  m_graphCache(GRAPH_CACHE_COST),
   m_locked(false),
-  m_drawIncomingArcs(true),
-  m_useFolderName(true),
-  m_useShortNames(true),
   m_ShowUsesOnEdgeHover(true),
-  m_controlFlowMode(ControlFlowClass),
-  m_clusteringModes(ClusteringNamespace),
   m_graphThreadRunning(false),
-  m_abort(false),
-  m_collector(0)
+  m_updatingGraph(false),
+  m_cursorPending(false),
+  m_cursorTimer(new QTimer(this)),
+  m_prefetchPending(false),
+  m_snapshotEdges(0)
 {
-    qRegisterMetaType<Use>("Use");
+    m_requestedSettings = m_settings;
+    m_cursorTimer->setSingleShot(true);
+    m_cursorTimer->setInterval(CURSOR_DEBOUNCE_INTERVAL);
+    connect(m_cursorTimer, SIGNAL(timeout()), SLOT(processCursorPosition()));
 }
 
 DUChainControlFlow::~DUChainControlFlow()
 {
+    cancelPrefetch();
     KDevelop::ICore::self()->languageController()->backgroundParser()->revertAllRequests(this);
-    delete m_collector;
 }
 
 void DUChainControlFlow::setControlFlowMode(ControlFlowMode controlFlowMode)
 {
-    m_controlFlowMode = controlFlowMode;
+    m_requestedSettings.controlFlowMode = controlFlowMode;
 }
 
 void DUChainControlFlow::setClusteringModes(ClusteringModes clusteringModes)
 {
-    m_clusteringModes = clusteringModes;
+    m_requestedSettings.clusteringModes = clusteringModes;
 }
 
 DUChainControlFlow::ClusteringModes DUChainControlFlow::clusteringModes() const
 {
-    return m_clusteringModes;
+    return m_requestedSettings.clusteringModes;
 }
 
-void DUChainControlFlow::generateControlFlowForDeclaration(IndexedDeclaration idefinition, IndexedTopDUContext itopContext, IndexedDUContext iuppermostExecutableContext)
+void DUChainControlFlow::lockReleased()
 {
-    DUChainReadLocker lock(DUChain::lock());
-
-    Declaration *definition = idefinition.data();
-    if (!definition)
-        return;
-    
-    TopDUContext *topContext = itopContext.data();
-    if (!topContext)
+    // Only new interactive graphs are streamed, updates keep showing the previous graph until they are done
+    if (!m_graphThreadRunning || m_updatingGraph || !m_dotControlFlowGraph)
         return;
 
-    DUContext *uppermostExecutableContext = iuppermostExecutableContext.data();
-    if (!uppermostExecutableContext)
+    int edges = m_graphData->edges().size();
+    if (edges == m_snapshotEdges || m_snapshotTimer.elapsed() < SNAPSHOT_INTERVAL)
         return;
 
-    // Convert to a declaration in accordance with control flow mode (function, class or namespace)
-    Declaration *nodeDefinition = declarationFromControlFlowMode(definition);
+    // Posted as a copy, the shown graph data is only changed on the GUI thread
+    QMetaObject::invokeMethod(m_dotControlFlowGraph, "showGraph", Qt::QueuedConnection, Q_ARG(ControlFlowGraphData, *m_graphData));
+    m_snapshotEdges = edges;
+    m_snapshotTimer.restart();
+}
 
-    QStringList containers;
-    prepareContainers(containers, definition);
+bool DUChainControlFlow::isLocked()
+{
+    return m_locked;
+}
 
-    QString shortName = shortNameFromContainers(containers, prependFolderNames(nodeDefinition));
+void DUChainControlFlow::run()
+{
+    m_snapshotEdges = 0;
+    m_snapshotTimer.start();
+    clearDeclarationInfo();
 
-    if (m_maxLevel != 1 && !m_visitedFunctions.contains(idefinition) && nodeDefinition && nodeDefinition->internalContext())
+    // Updates are patched into a copy of the shown graph, see startUpdate()
+    if (m_updatingGraph)
+        updateFunctionBodies(m_changedBodies, m_definition, m_updatedClusterMap);
+    else
     {
-        m_dotControlFlowGraph->foundRootNode(containers, (m_controlFlowMode == ControlFlowNamespace &&
-                                        nodeDefinition->internalContext() && nodeDefinition->internalContext()->type() != DUContext::Namespace) ? 
-                                                                          globalNamespaceOrFolderNames(nodeDefinition):
-                                                                          shortName);
-        ++m_currentLevel;
-        m_visitedFunctions.insert(idefinition);
-        m_identifierDeclarationMap[containers.join("") + shortName] = IndexedDeclaration(nodeDefinition);
-        useDeclarationsFromDefinition(definition, topContext, uppermostExecutableContext);
+        generateControlFlowForDeclaration(m_definition, m_topContext, m_uppermostExecutableContext);
+        collectIncomingArcs();
     }
+    if (!m_abort)
+        pruneFunctionBodies();
+    // The graph is shown by jobDone(), an aborted one is replaced as soon as the job is done
+}
 
-    if (m_abort)
+void DUChainControlFlow::cursorPositionChanged(KTextEditor::View *view, const KTextEditor::Cursor &cursor)
+{
+    Q_UNUSED(cursor)
+    // Coalesced, only the function the cursor rests in is generated
+    m_cursorView = view;
+    m_cursorTimer->start();
+}
+
+void DUChainControlFlow::processCursorPosition()
+{
+    KTextEditor::View *view = m_cursorView;
+    if (m_locked || !view || !view->document())
         return;
 
-    if (m_drawIncomingArcs)
+    if (m_graphThreadRunning)
     {
-        Declaration *declaration = definition;
-        if (declaration->isDefinition())
-            declaration = DUChainUtils::declarationForDefinition(declaration, topContext);
-
-        if (declaration)
+        IndexedDUContext uppermostExecutableContext;
         {
-            delete m_collector;
-            m_collector = new ControlFlowGraphUsesCollector(declaration);
-            m_collector->setProcessDeclarations(true);
-            connect(m_collector, SIGNAL(processFunctionCall(Declaration*, Declaration*, Use)), SLOT(processFunctionCall(Declaration*, Declaration*, Use)));
-            m_collector->startCollecting();
+            DUChainReadLocker lock(DUChain::lock());
+            TopDUContext *topContext = DUChainUtils::standardContextForUrl(view->document()->url());
+            DUContext *context = topContext ? executableContextAt(topContext, view, view->cursorPosition()) : 0;
+            if (context)
+                uppermostExecutableContext = IndexedDUContext(uppermostExecutableContextOf(context));
         }
+        // The running job is superseded, it stops at its next abort check and jobDone() comes back here
+        if (!(uppermostExecutableContext == m_previousUppermostExecutableContext))
+        {
+            m_cursorPending = true;
+            requestAbort();
+        }
+        return;
     }
 
-    m_dotControlFlowGraph->graphDone();
-    m_currentLevel = 1;
+    showGraphAt(view, view->cursorPosition());
 }
 
-bool DUChainControlFlow::isLocked()
+DUContext *DUChainControlFlow::executableContextAt(TopDUContext *topContext, KTextEditor::View *view, const KTextEditor::Cursor &cursor)
 {
-    return m_locked;
+    DUContext *context = topContext->findContextAt(topContext->transformToLocalRevision(KDevelop::SimpleCursor(cursor)));
+    if (!context)
+        return 0;
+
+    // If cursor is in a method arguments context change it to internal context
+    if (context->type() == DUContext::Function && context->importers().size() == 1)
+        context = context->importers()[0];
+
+    Declaration *declarationUnderCursor = DUChainUtils::itemUnderCursor(view->document()->url(), KDevelop::SimpleCursor(cursor));
+    if (declarationUnderCursor && (!context || context->type() != DUContext::Other) && declarationUnderCursor->internalContext())
+        context = declarationUnderCursor->internalContext();
+
+    return (context && context->type() == DUContext::Other) ? context : 0;
 }
 
-void DUChainControlFlow::run()
+DUContext *DUChainControlFlow::uppermostExecutableContextOf(DUContext *context)
 {
-    DUChainReadLocker lock(DUChain::lock());
-
-    m_abort = false;
-    generateControlFlowForDeclaration(m_definition, m_topContext, m_uppermostExecutableContext);
+    while (context->parentContext() && context->parentContext()->type() == DUContext::Other)
+        context = context->parentContext();
+    return context;
 }
 
-void DUChainControlFlow::cursorPositionChanged(KTextEditor::View *view, const KTextEditor::Cursor &cursor)
+void DUChainControlFlow::showGraphAt(KTextEditor::View *view, const KTextEditor::Cursor &cursor)
 {
     if (!m_graphThreadRunning)
     {
@@ -184,28 +231,13 @@ void DUChainControlFlow::cursorPositionChanged(KTextEditor::View *view, const KT
         TopDUContext *topContext = DUChainUtils::standardContextForUrl(view->document()->url());
         if (!topContext) return;
 
-        DUContext *context = topContext->findContextAt(topContext->transformToLocalRevision(KDevelop::SimpleCursor(cursor)));
-
+        DUContext *context = executableContextAt(topContext, view, cursor);
         if (!context)
-        {
-            newGraph();
-            m_previousUppermostExecutableContext = IndexedDUContext();
-            return;
-        }
-
-        // If cursor is in a method arguments context change it to internal context
-        if (context && context->type() == DUContext::Function && context->importers().size() == 1)
-            context = context->importers()[0];
-
-        Declaration *declarationUnderCursor = DUChainUtils::itemUnderCursor(view->document()->url(), KDevelop::SimpleCursor(cursor));
-        if (declarationUnderCursor && (!context || context->type() != DUContext::Other) && declarationUnderCursor->internalContext())
-            context = declarationUnderCursor->internalContext();
-
-        if (!context || context->type() != DUContext::Other)
         {
             // If there is a previous graph
             if (!(m_previousUppermostExecutableContext == IndexedDUContext()))
             {
+                cacheShownLayout();
                 newGraph();
                 m_previousUppermostExecutableContext = IndexedDUContext();
             }
@@ -216,31 +248,24 @@ void DUChainControlFlow::cursorPositionChanged(KTextEditor::View *view, const KT
         m_currentView = view;
         m_topContext = IndexedTopDUContext(topContext);
 
-        m_currentProject = ICore::self()->projectController()->findProjectForUrl(m_currentView->document()->url());
-        m_includeDirectories.clear();
+        // The resolver goes away with the plugin
+        ControlFlowGraphLocationResolver *resolver = locationResolver();
+        m_project = resolver ? resolver->projectForUrl(IndexedString(m_currentView->document()->url())) : 0;
 
-        // Invoke includeDirectories in advance. Running it in the background thread may crash because
+        // Prepare include directories in advance. Running it in the background thread may crash because
         // of thread-safety issues in KConfig / CMakeUtils.
-        if (m_currentProject)
-        {
-            KDevelop::ProjectBaseItem *project_item = m_currentProject->projectItem();
-            IBuildSystemManager *buildSystemManager = 0;
-            if (project_item && (buildSystemManager = m_currentProject->buildSystemManager()))
-                m_includeDirectories = buildSystemManager->includeDirectories(project_item);
-        }
+        if (resolver)
+            resolver->prepareProject(m_project);
 
         // Navigate to uppermost executable context
-        DUContext *uppermostExecutableContext = m_currentContext.data();
-        if (!uppermostExecutableContext)
-            return;
-
-        while (uppermostExecutableContext->parentContext() && uppermostExecutableContext->parentContext()->type() == DUContext::Other)
-            uppermostExecutableContext = uppermostExecutableContext->parentContext();
+        DUContext *uppermostExecutableContext = uppermostExecutableContextOf(context);
 
         // If cursor is in the same function definition
         if (IndexedDUContext(uppermostExecutableContext) == m_previousUppermostExecutableContext)
             return;
 
+        cacheShownLayout();
+
         m_previousUppermostExecutableContext = IndexedDUContext(uppermostExecutableContext);
 
         // Get the definition
@@ -252,102 +277,73 @@ void DUChainControlFlow::cursorPositionChanged(KTextEditor::View *view, const KT
 
         if (!definition) return;
 
-        newGraph();
-        m_dotControlFlowGraph->prepareNewGraph();
-
         m_definition = IndexedDeclaration(definition);
         m_uppermostExecutableContext = IndexedDUContext(uppermostExecutableContext);
 
-        m_graphThreadRunning = true;
-        DUChainControlFlowJob *job = new DUChainControlFlowJob(context->scopeIdentifier().toString(), this);
-        connect (job, SIGNAL(result(KJob*)), SLOT(jobDone(KJob*)));
-	emit startingJob();
-	ICore::self()->runController()->registerJob(job);
-    }
-    else
-        kDebug() << "Control flow thread already running";
-}
-
-void DUChainControlFlow::processFunctionCall(Declaration *source, Declaration *target, const Use &use)
-{
-    FunctionDefinition *calledFunctionDefinition;
-    DUContext *calledFunctionContext;
-
-    DUChainReadLocker lock(DUChain::lock());
-
-    // Convert to a declaration in accordance with control flow mode (function, class or namespace)
-    Declaration *nodeSource = declarationFromControlFlowMode(source);
-    Declaration *nodeTarget = declarationFromControlFlowMode(target);
-
-    // Try to acquire the called function definition
-    calledFunctionDefinition = FunctionDefinition::definition(target);
-
-    QStringList sourceContainers, targetContainers;
+        m_graphKey.context = m_uppermostExecutableContext;
+        m_graphKey.settings = m_requestedSettings;
 
-    prepareContainers(sourceContainers, source);
-    prepareContainers(targetContainers, target);
-
-    QString sourceLabel = shortNameFromContainers(sourceContainers,
-                          (m_controlFlowMode == ControlFlowNamespace &&
-                           (nodeSource->internalContext() && nodeSource->internalContext()->type() != DUContext::Namespace)) ?
-                                            globalNamespaceOrFolderNames(nodeSource) :
-                                            prependFolderNames(nodeSource));
-
-    QString targetLabel = shortNameFromContainers(targetContainers,
-                          (m_controlFlowMode == ControlFlowNamespace &&
-                           (nodeTarget->internalContext() && nodeTarget->internalContext()->type() != DUContext::Namespace)) ?
-                                            globalNamespaceOrFolderNames(nodeTarget) :
-                                            prependFolderNames(nodeTarget));
+        if (showCachedGraph())
+        {
+            // Shown as cached, patched in the background only if a visited body was reparsed since
+            QList<IndexedDeclaration> changedBodies = changedFunctionBodies();
+            if (!changedBodies.isEmpty())
+                startUpdate(context->scopeIdentifier().toString(), changedBodies);
+            else
+                startPrefetch();
+            return;
+        }
 
-    QString sourceShortName = shortNameFromContainers(sourceContainers, prependFolderNames(nodeSource));
-    QString targetShortName = shortNameFromContainers(targetContainers, prependFolderNames(nodeTarget));
+        newGraph();
+        m_dotControlFlowGraph->prepareNewGraph();
 
-    if (sender() && dynamic_cast<ControlFlowGraphUsesCollector *>(sender()))
-    {
-        sourceContainers.prepend(i18n("Uses of %1", targetLabel));
-        m_identifierDeclarationMap[sourceContainers.join("") + sourceShortName] = IndexedDeclaration(nodeSource);
+        startGraphJob(context->scopeIdentifier().toString(), true);
     }
-
-    IndexedDeclaration ideclaration = IndexedDeclaration(calledFunctionDefinition);
-    m_dotControlFlowGraph->foundFunctionCall(sourceContainers, sourceLabel, targetContainers, targetLabel); 
-
-    if (calledFunctionDefinition)
-        calledFunctionContext = calledFunctionDefinition->internalContext();
     else
     {
-        // Store method declaration for navigation
-        m_identifierDeclarationMap[targetContainers.join("") + targetShortName] = IndexedDeclaration(nodeTarget);
-        // Store use for edge inspection
-        QPair<RangeInRevision, IndexedString> pair(use.m_range, source->url());
-        if (!m_arcUsesMap.values(sourceLabel + "->" + targetLabel).contains(pair))
-            m_arcUsesMap.insertMulti(sourceLabel + "->" + targetLabel, pair);
-        return;
+        // Superseded, the graph is shown again from jobDone() once the running job stopped
+        m_cursorView = view;
+        m_cursorPending = true;
+        requestAbort();
     }
+}
 
-    // Store use for edge inspection
-    QPair<RangeInRevision, IndexedString> pair(use.m_range, source->url());
-    if (!m_arcUsesMap.values(sourceLabel + "->" + targetLabel).contains(pair))
-        m_arcUsesMap.insertMulti(sourceLabel + "->" + targetLabel, pair);
-    // Store method definition for navigation
-    m_identifierDeclarationMap[targetContainers.join("") + targetShortName] = IndexedDeclaration(declarationFromControlFlowMode(calledFunctionDefinition));
-
-    if (calledFunctionContext && (m_currentLevel < m_maxLevel || m_maxLevel == 0))
-    {
-        // For prevent endless loop in recursive methods
-        if (!m_visitedFunctions.contains(ideclaration))
-        {
-            ++m_currentLevel;
-            m_visitedFunctions.insert(ideclaration);
-            // Recursive call for method invocation
-            useDeclarationsFromDefinition(calledFunctionDefinition, calledFunctionDefinition->topContext(), calledFunctionContext);
-        }
-    }
+void DUChainControlFlow::startGraphJob(const QString &jobName, bool newGraph)
+{
+    m_graphThreadRunning = true;
+    // Reset before the job is queued, so an abort requested before it starts is not lost
+    m_abort = false;
+    // The job works on its own copy, the setters only change the settings of the next graph
+    setSettings(m_graphKey.settings);
+    // Real work goes first, speculative work is dropped
+    cancelPrefetch();
+    // The shown graph is exported, laid out and browsed from while the job runs, so the job builds its
+    // own graph, only swapped in by jobDone(). Updates start from a copy of the shown graph
+    if (newGraph)
+        m_jobGraphData.clear();
+    m_graphData = &m_jobGraphData;
+    DUChainControlFlowJob *job = new DUChainControlFlowJob(jobName, this);
+    connect (job, SIGNAL(result(KJob*)), SLOT(jobDone(KJob*)));
+    // Updates keep the current graph usable until the patched one is ready
+    if (newGraph)
+        emit startingJob();
+    ICore::self()->runController()->registerJob(job);
 }
 
 void DUChainControlFlow::updateToolTip(const QString &edge, const QPoint& point, QWidget *partWidget)
 {
+    int edgeId = m_graphData->edgeFromName(edge);
+    if (edgeId == -1 || !m_edgeUses.useCount(edgeId))
+        return;
+
+    ControlFlowGraphNavigationContext::ArcUses arcUses;
+    {
+        DUChainReadLocker lock(DUChain::lock());
+        arcUses = m_edgeUses.uses(edgeId);
+    }
+
     ControlFlowGraphNavigationWidget *navigationWidget =
-                new ControlFlowGraphNavigationWidget(edge, m_arcUsesMap.values(edge));
+                new ControlFlowGraphNavigationWidget(m_graphData->edgeLabel(edgeId), arcUses);
     
     KDevelop::NavigationToolTip *usesToolTip = new KDevelop::NavigationToolTip(
                                   partWidget,
@@ -361,13 +357,23 @@ void DUChainControlFlow::updateToolTip(const QString &edge, const QPoint& point,
 void DUChainControlFlow::slotGraphElementSelected(QList<QString> list, const QPoint& point)
 {
     Q_UNUSED(point)
-    if (!list.isEmpty())
+    // Snapshots are only browsed while the graph is still being generated
+    if (!list.isEmpty() && !m_graphThreadRunning)
     {
-        QString label = list[0];
-        Declaration *declaration = m_identifierDeclarationMap[label].data();
-        
+        if (DotControlFlowGraph::isCollapsedClusterName(list[0])) // Collapsed cluster click, show its members
+        {
+            m_dotControlFlowGraph->expandCluster(list[0]);
+            return;
+        }
+
+        int node = m_graphData->nodeFromName(list[0]);
+        if (node == -1)
+            return;
+
         DUChainReadLocker lock(DUChain::lock());
-        
+
+        Declaration *declaration = m_graphData->nodes()[node].declaration.data();
+
         if (declaration) // Node click, jump to definition/declaration
         {
             KUrl url(declaration->url().str());
@@ -384,7 +390,7 @@ void DUChainControlFlow::slotGraphElementSelected(QList<QString> list, const QPo
 
 void DUChainControlFlow::slotEdgeHover(QString label)
 {
-    if (label.contains("->") && m_ShowUsesOnEdgeHover) // Edge click, show uses contained in the edge
+    if (label.contains("->") && m_ShowUsesOnEdgeHover && !m_graphThreadRunning) // Edge click, show uses contained in the edge
     {
         KParts::ReadOnlyPart *part = dynamic_cast<KParts::ReadOnlyPart *>(sender());
         if (!part)
@@ -400,22 +406,27 @@ void DUChainControlFlow::setLocked(bool locked)
 
 void DUChainControlFlow::setUseFolderName(bool useFolderName)
 {
-    m_useFolderName = useFolderName;
+    m_requestedSettings.useFolderName = useFolderName;
 }
 
 void DUChainControlFlow::setUseShortNames(bool useShortNames)
 {
-    m_useShortNames = useShortNames;
+    m_requestedSettings.useShortNames = useShortNames;
 }
 
 void DUChainControlFlow::setDrawIncomingArcs(bool drawIncomingArcs)
 {
-    m_drawIncomingArcs = drawIncomingArcs;
+    m_requestedSettings.drawIncomingArcs = drawIncomingArcs;
 }
 
 void DUChainControlFlow::setMaxLevel(int maxLevel)
 {
-    m_maxLevel = maxLevel;
+    m_requestedSettings.maxLevel = maxLevel;
+}
+
+void DUChainControlFlow::setMaxCallerLevel(int maxCallerLevel)
+{
+    m_requestedSettings.maxCallerLevel = maxCallerLevel;
 }
 
 void DUChainControlFlow::setShowUsesOnEdgeHover(bool checked)
@@ -436,187 +447,273 @@ void DUChainControlFlow::refreshGraph()
                 m_previousUppermostExecutableContext = IndexedDUContext();
             }
             KTextEditor::View *view = ICore::self()->documentController()->activeDocument()->textDocument()->activeView();
-            cursorPositionChanged(view, view->cursorPosition());
+            showGraphAt(view, view->cursorPosition());
         }
     }
 }
 
+void DUChainControlFlow::updateGraph()
+{
+    if (m_locked || m_graphThreadRunning)
+        return;
+
+    IDocument *activeDocument = ICore::self()->documentController()->activeDocument();
+    if (!activeDocument || !activeDocument->textDocument() || !activeDocument->textDocument()->activeView())
+        return;
+
+    // The reparse may have moved the cursor to another function, which needs a new graph
+    KTextEditor::View *view = activeDocument->textDocument()->activeView();
+    showGraphAt(view, view->cursorPosition());
+    if (m_graphThreadRunning || m_previousUppermostExecutableContext == IndexedDUContext())
+        return;
+
+    QString jobName;
+    QList<IndexedDeclaration> changedBodies;
+    {
+        DUChainReadLocker lock(DUChain::lock());
+        changedBodies = changedFunctionBodies();
+        if (changedBodies.isEmpty())
+            return;
+
+        Declaration *definition = m_definition.data();
+        if (!definition)
+            return;
+        jobName = definition->qualifiedIdentifier().toString();
+    }
+
+    startUpdate(jobName, changedBodies);
+}
+
+void DUChainControlFlow::startUpdate(const QString &jobName, const QList<IndexedDeclaration> &changedBodies)
+{
+    m_updatingGraph = true;
+    m_changedBodies = changedBodies;
+    m_jobGraphData = *m_dotControlFlowGraph->graphData();
+    m_updatedClusterMap.clear();
+    m_previousVisitedFunctions = m_visitedFunctions;
+    m_previousEdgeUses = m_edgeUses;
+    m_previousFunctionBodies = m_functionBodies;
+    startGraphJob(jobName, false);
+}
+
 void DUChainControlFlow::newGraph()
 {
     m_visitedFunctions.clear();
-    m_identifierDeclarationMap.clear();
-    m_arcUsesMap.clear();
-    m_currentProject = 0;
+    m_edgeUses.clear();
+    m_project = 0;
     m_dotControlFlowGraph->clearGraph();
 }
 
-void DUChainControlFlow::jobDone (KJob* job)
+bool DUChainControlFlow::showCachedGraph()
 {
-    m_graphThreadRunning = false;
-    job->deleteLater();
-    emit jobDone();
+    CachedGraph *cachedGraph = m_graphCache.object(m_graphKey);
+    if (!cachedGraph)
+        return false;
+
+    *m_graphData = cachedGraph->graphData;
+    m_visitedFunctions = cachedGraph->visitedFunctions;
+    m_edgeUses = cachedGraph->edgeUses;
+    m_functionBodies = cachedGraph->functionBodies;
+    if (cachedGraph->layout.isEmpty() || !m_dotControlFlowGraph->showLayout(cachedGraph->expandedClusters, cachedGraph->layout))
+    {
+        m_dotControlFlowGraph->collapseClusters();
+        m_dotControlFlowGraph->graphDone();
+    }
+    return true;
 }
 
-void DUChainControlFlow::useDeclarationsFromDefinition (Declaration *definition, TopDUContext *topContext, DUContext *context)
+void DUChainControlFlow::cacheShownLayout()
 {
-    if (!topContext) return;
+    CachedGraph *cachedGraph = m_graphCache.object(m_graphKey);
+    if (!cachedGraph || !m_dotControlFlowGraph)
+        return;
+
+    // Graphs left before their layout came back are laid out again when shown
+    QSet<int> expandedClusters;
+    QByteArray layout = m_dotControlFlowGraph->shownLayout(&expandedClusters);
+    if (layout.isEmpty())
+        return;
+    cachedGraph->layout = layout;
+    cachedGraph->expandedClusters = expandedClusters;
+}
 
-    const Use *uses = context->uses();
-    unsigned int usesCount = context->usesCount();
-    QVector<DUContext *> subContexts = context->childContexts();
-    QVector<DUContext *>::iterator subContextsIterator = subContexts.begin();
-    QVector<DUContext *>::iterator subContextsEnd      = subContexts.end();
+void DUChainControlFlow::jobDone (KJob* job)
+{
+    m_graphThreadRunning = false;
+    job->deleteLater();
 
-    Declaration *declaration;
-    for (unsigned int i = 0; i < usesCount; ++i)
+    bool updated = m_updatingGraph;
+    m_graphData = m_dotControlFlowGraph->graphData();
+    if (!m_updatingGraph)
     {
+        if (!m_abort)
+            m_dotControlFlowGraph->showGraph(m_jobGraphData);
+        m_jobGraphData.clear();
+    }
+    else
+    {
+        m_updatingGraph = false;
+        // The shown graph is left as it was, so hovering and navigating keep working on it
         if (m_abort)
-            return;
-
-        declaration = topContext->usedDeclarationForIndex(uses[i].m_declarationIndex);
-        if (declaration && declaration->type<KDevelop::FunctionType>())
         {
-            if (subContextsIterator != subContextsEnd)
-            {
-                if (uses[i].m_range.start < (*subContextsIterator)->range().start)
-                    processFunctionCall(definition, declaration, uses[i]);
-                else if ((*subContextsIterator)->type() == DUContext::Other)
-                {
-                    // Recursive call for sub-contexts
-                    useDeclarationsFromDefinition(definition, topContext, *subContextsIterator);
-                    ++subContextsIterator;
-                    --i;
-                }
-            }
-            else
-                processFunctionCall(definition, declaration, uses[i]);
+            m_visitedFunctions = m_previousVisitedFunctions;
+            m_edgeUses = m_previousEdgeUses;
+            m_functionBodies = m_previousFunctionBodies;
         }
+        // Nothing to refresh if the changed bodies still call the same functions
+        else if (!m_graphData->hasSameGraph(m_jobGraphData))
+            m_dotControlFlowGraph->updateGraph(m_jobGraphData, m_updatedClusterMap);
+        m_jobGraphData.clear();
+        m_updatedClusterMap.clear();
+        m_changedBodies.clear();
+        m_previousVisitedFunctions.clear();
+        m_previousEdgeUses.clear();
+        m_previousFunctionBodies.clear();
     }
-    while (subContextsIterator != subContextsEnd)
-        if ((*subContextsIterator)->type() == DUContext::Other)
-        {
-            // Recursive call for remaining sub-contexts
-            useDeclarationsFromDefinition(definition, topContext, *subContextsIterator);
-            ++subContextsIterator;
-        }
-}
 
-Declaration *DUChainControlFlow::declarationFromControlFlowMode(Declaration *definitionDeclaration)
-{
-    Declaration *nodeDeclaration = definitionDeclaration;
+    if (!m_abort && !(m_graphKey.context == IndexedDUContext()))
+    {
+        CachedGraph *cachedGraph = new CachedGraph;
+        cachedGraph->graphData = *m_graphData;
+        cachedGraph->visitedFunctions = m_visitedFunctions;
+        cachedGraph->edgeUses = m_edgeUses;
+        cachedGraph->functionBodies = m_functionBodies;
+        m_graphCache.insert(m_graphKey, cachedGraph, 1 + m_graphData->nodes().size() + m_graphData->edges().size());
+    }
+    // An aborted graph is incomplete, it is generated again when the cursor comes back to its function
+    else if (m_abort && !updated)
+        m_previousUppermostExecutableContext = IndexedDUContext();
+
+    emit jobDone();
 
-    if (m_controlFlowMode != ControlFlowFunction)
+    if (m_cursorPending)
     {
-        if (nodeDeclaration->isDefinition())
-            nodeDeclaration = DUChainUtils::declarationForDefinition(nodeDeclaration, nodeDeclaration->topContext());
-        if (!nodeDeclaration || !nodeDeclaration->context() || !nodeDeclaration->context()->owner()) return definitionDeclaration;
-        while (nodeDeclaration->context() &&
-               nodeDeclaration->context()->owner() &&
-               ((m_controlFlowMode == ControlFlowClass && nodeDeclaration->context() && nodeDeclaration->context()->type() == DUContext::Class) ||
-                (m_controlFlowMode == ControlFlowNamespace && (
-                                                              (nodeDeclaration->context() && nodeDeclaration->context()->type() == DUContext::Class) ||
-                                                              (nodeDeclaration->context() && nodeDeclaration->context()->type() == DUContext::Namespace))
-              )))
-            nodeDeclaration = nodeDeclaration->context()->owner();
+        m_cursorPending = false;
+        processCursorPosition();
     }
-    return nodeDeclaration;
+    else if (!m_abort)
+        startPrefetch();
 }
 
-void DUChainControlFlow::prepareContainers(QStringList &containers, Declaration* definition)
+void DUChainControlFlow::startPrefetch()
 {
-    ControlFlowMode originalControlFlowMode = m_controlFlowMode;
-    QString strGlobalNamespaceOrFolderNames;
-
-    // Handling project clustering
-    if (m_clusteringModes.testFlag(ClusteringProject) && ICore::self()->projectController()->findProjectForUrl(definition->url().str()))
-        containers << ICore::self()->projectController()->findProjectForUrl(definition->url().str())->name();
+    // Only graphs shown in a view are worth prefetching
+    if (!m_dotControlFlowGraph || m_locked)
+        return;
 
-    // Handling namespace clustering
-    if (m_clusteringModes.testFlag(ClusteringNamespace))
+    if (m_prefetchJob)
     {
-        m_controlFlowMode = ControlFlowNamespace;
-        Declaration *namespaceDefinition = declarationFromControlFlowMode(definition);
-
-        strGlobalNamespaceOrFolderNames = ((namespaceDefinition->internalContext() && namespaceDefinition->internalContext()->type() != DUContext::Namespace) ?
-                                                              globalNamespaceOrFolderNames(namespaceDefinition):
-                                                              shortNameFromContainers(containers, prependFolderNames(namespaceDefinition)));
-        foreach(const QString &container, strGlobalNamespaceOrFolderNames.split("::"))
-            containers << container;
+        m_prefetchJob->requestAbort();
+        m_prefetchPending = true;
+        return;
     }
 
-    // Handling class clustering
-    if (m_clusteringModes.testFlag(ClusteringClass))
-    {
-        m_controlFlowMode = ControlFlowClass;
-        Declaration *classDefinition = declarationFromControlFlowMode(definition);
-        
-        if (classDefinition->internalContext() && classDefinition->internalContext()->type() == DUContext::Class)
-            containers << shortNameFromContainers(containers, prependFolderNames(classDefinition));
-    }
+    QList<IndexedDeclaration> definitions = prefetchTargets();
+    if (definitions.isEmpty())
+        return;
 
-    m_controlFlowMode = originalControlFlowMode;
+    m_prefetchJob = new ControlFlowGraphPrefetchJob(m_requestedSettings, m_project, locationResolver(), definitions);
+    connect(m_prefetchJob, SIGNAL(done(ThreadWeaver::Job*)), SLOT(prefetchDone(ThreadWeaver::Job*)));
+    // Also deletes jobs outliving this
+    connect(m_prefetchJob, SIGNAL(done(ThreadWeaver::Job*)), m_prefetchJob, SLOT(deleteLater()));
+    ThreadWeaver::Weaver::instance()->enqueue(m_prefetchJob);
 }
 
-QString DUChainControlFlow::globalNamespaceOrFolderNames(Declaration *declaration)
+void DUChainControlFlow::cancelPrefetch()
 {
-    if (m_useFolderName && m_currentProject && m_includeDirectories.count() > 0)
-    {
-        int minLength = std::numeric_limits<int>::max();
+    m_prefetchPending = false;
+    if (m_prefetchJob)
+        m_prefetchJob->requestAbort();
+}
 
-        QString folderName, smallestDirectory, declarationUrl = declaration->url().str();
+void DUChainControlFlow::prefetchDone(ThreadWeaver::Job *job)
+{
+    typedef QPair<GraphKey, CachedGraph *> Graph;
+    foreach (const Graph &graph, static_cast<ControlFlowGraphPrefetchJob *>(job)->takeGraphs())
+    {
+        // Settings may have changed meanwhile, graphs are only found with the settings they were made with
+        if (m_graphCache.contains(graph.first))
+            delete graph.second;
+        else
+            m_graphCache.insert(graph.first, graph.second, 1 + graph.second->graphData.nodes().size() + graph.second->graphData.edges().size());
+    }
+    m_prefetchJob = 0;
 
-        foreach (const Path &url, m_includeDirectories)
-        {
-            QString urlString = url.toLocalFile();
-            if (urlString.length() <= minLength && declarationUrl.startsWith(urlString))
-            {
-                smallestDirectory = urlString;
-                minLength = urlString.length();
-            }
-        }
-        declarationUrl = declarationUrl.remove(0, smallestDirectory.length());
-        declarationUrl = declarationUrl.remove(KUrl(declaration->url().str()).fileName());
-        if (declarationUrl.endsWith('/'))
-            declarationUrl.chop(1);
-        if (declarationUrl.startsWith('/'))
-            declarationUrl.remove(0, 1);
-        declarationUrl = declarationUrl.replace('/', "::");
-        if (!declarationUrl.isEmpty())
-            return declarationUrl;
+    if (m_prefetchPending && !m_graphThreadRunning)
+    {
+        m_prefetchPending = false;
+        startPrefetch();
     }
-    return i18n("Global Namespace");
 }
 
-QString DUChainControlFlow::prependFolderNames(Declaration *declaration)
+QList<IndexedDeclaration> DUChainControlFlow::prefetchTargets()
 {
-    QString prependedQualifiedName = declaration->qualifiedIdentifier().toString();
-    if (m_useFolderName)
+    QList<IndexedDeclaration> targets;
+    DUChainReadLocker lock(DUChain::lock());
+    Declaration *definition = m_definition.data();
+    TopDUContext *topContext = m_topContext.data();
+    if (!definition || !topContext)
+        return targets;
+
+    // The definitions right before and after the shown one, in the same file
+    QList<Declaration *> definitions;
+    collectFunctionDefinitions(topContext, definitions);
+    int index = definitions.indexOf(definition);
+    if (index > 0)
+        targets.append(IndexedDeclaration(definitions[index-1]));
+    if (index != -1 && index + 1 < definitions.size())
+        targets.append(IndexedDeclaration(definitions[index+1]));
+
+    // Then the functions it calls, in call order
+    int callees = 0;
+    typedef QPair<IndexedDeclaration, RangeInRevision> Call;
+    foreach (const Call &call, m_functionBodies.value(m_definition).calls)
     {
-        ControlFlowMode originalControlFlowMode = m_controlFlowMode;
-        m_controlFlowMode = ControlFlowNamespace;
-        Declaration *namespaceDefinition = declarationFromControlFlowMode(declaration);
-        m_controlFlowMode = originalControlFlowMode;
-
-        QString prefix = globalNamespaceOrFolderNames(namespaceDefinition);
-        
-        if (namespaceDefinition && namespaceDefinition->internalContext() &&
-            namespaceDefinition->internalContext()->type() != DUContext::Namespace &&
-            prefix != i18n("Global Namespace"))
-            prependedQualifiedName.prepend(prefix + "::");
+        if (callees == PREFETCH_CALLEES)
+            break;
+        Declaration *callee = call.first.data();
+        Declaration *calleeDefinition = callee ? FunctionDefinition::definition(callee) : 0;
+        if (!calleeDefinition && callee && callee->isDefinition())
+            calleeDefinition = callee;
+        if (!calleeDefinition || !calleeDefinition->internalContext() || calleeDefinition == definition ||
+            targets.contains(IndexedDeclaration(calleeDefinition)))
+            continue;
+        targets.append(IndexedDeclaration(calleeDefinition));
+        ++callees;
     }
 
-    return prependedQualifiedName;
+    // Graphs already cached with the current settings are kept as they are
+    QList<IndexedDeclaration>::iterator it = targets.begin();
+    while (it != targets.end())
+    {
+        GraphKey graphKey = { IndexedDUContext(it->data()->internalContext()), m_requestedSettings };
+        if (m_graphCache.contains(graphKey))
+            it = targets.erase(it);
+        else
+            ++it;
+    }
+    return targets;
 }
 
-QString DUChainControlFlow::shortNameFromContainers(const QList<QString> &containers, const QString &qualifiedIdentifier)
+static bool startsBefore(Declaration *declaration, Declaration *other)
 {
-    QString shortName = qualifiedIdentifier;
+    return declaration->range().start < other->range().start;
+}
 
-    if (m_useShortNames)
+void DUChainControlFlow::collectFunctionDefinitions(DUContext *context, QList<Declaration *> &definitions)
+{
+    foreach (Declaration *declaration, context->localDeclarations())
     {
-        foreach(const QString &container, containers)
-            if (shortName.contains(container))
-                shortName.remove(shortName.indexOf(container + "::"), (container + "::").length());
+        DUContext *internalContext = declaration->internalContext();
+        if (!internalContext)
+            continue;
+        if (declaration->isDefinition() && internalContext->type() == DUContext::Other)
+            definitions.append(declaration);
+        else if (internalContext->type() == DUContext::Namespace || internalContext->type() == DUContext::Class)
+            collectFunctionDefinitions(internalContext, definitions);
     }
-    return shortName;
+
+    // Declarations of nested contexts are interleaved by position
+    if (context->type() == DUContext::Global)
+        qSort(definitions.begin(), definitions.end(), startsBefore);
 }
@@ -20,15 +20,13 @@
 #ifndef DUCHAINCONTROLFLOW_H
 #define DUCHAINCONTROLFLOW_H
 
-#include <QSet>
-#include <QHash>
-#include <QPair>
+#include <QCache>
 #include <QPointer>
+#include <QElapsedTimer>
 
 #include <KUrl>
 
-#include <language/duchain/ducontext.h>
-#include <util/path.h>
+#include "controlflowgraphtraversal.h"
 
 class QPoint;
 
@@ -37,49 +35,62 @@ namespace KTextEditor {
     class Cursor;
 }
 namespace KDevelop {
-    class Use;
     class IndexedString;
     class DUContext;
     class Declaration;
     class TopDUContext;
-    class IProject;
 }
 
 class KJob;
+class QTimer;
+
+namespace ThreadWeaver
+{
+    class Job;
+}
 
 class DotControlFlowGraph;
-class ControlFlowGraphUsesCollector;
+class ControlFlowGraphPrefetchJob;
 
 using namespace KDevelop;
 
-class DUChainControlFlow : public QObject
+// Generates the interactive graph of the function under the cursor of a tool view
+class DUChainControlFlow : public QObject, public ControlFlowGraphTraversal
 {
     Q_OBJECT
 public:
     DUChainControlFlow(DotControlFlowGraph *dotControlFlowGraph);
     virtual ~DUChainControlFlow();
 
-    enum ControlFlowMode { ControlFlowFunction, ControlFlowClass, ControlFlowNamespace };
     void setControlFlowMode(ControlFlowMode controlFlowMode);
-
-    enum ClusteringMode
-    {
-        ClusteringNone      = 0x0,
-        ClusteringClass     = 0x1,
-        ClusteringNamespace = 0x2,
-        ClusteringProject   = 0x4
-    };
-    Q_DECLARE_FLAGS(ClusteringModes, ClusteringMode)
     void setClusteringModes(ClusteringModes clusteringModes);
     ClusteringModes clusteringModes() const;
 
-    void generateControlFlowForDeclaration(IndexedDeclaration idefinition, IndexedTopDUContext itopContext, IndexedDUContext iuppermostExecutableContext);
     bool isLocked();
     void run();
 
+    // Finished interactive graphs, keyed by uppermost executable context and the settings they were made with
+    struct GraphKey
+    {
+        IndexedDUContext context;
+        Settings settings;
+        bool operator==(const GraphKey &other) const;
+    };
+    friend uint qHash(const GraphKey &key);
+    struct CachedGraph
+    {
+        ControlFlowGraphData graphData;
+        QHash<IndexedDeclaration, int> visitedFunctions;
+        ControlFlowGraphEdgeUses edgeUses;
+        QHash<IndexedDeclaration, FunctionBody> functionBodies;
+        // Layout of the graph when it was left, shown again instead of laying it out
+        QByteArray layout;
+        QSet<int> expandedClusters;
+    };
+
 public Q_SLOTS:
+    // Debounced, a running job is aborted if the cursor left its function
     void cursorPositionChanged(KTextEditor::View *view, const KTextEditor::Cursor &cursor);
-    void processFunctionCall(Declaration *source, Declaration *target, const Use &use);
 
     void slotGraphElementSelected(const QList<QString> list, const QPoint& point);
     void slotEdgeHover(QString label);
@@ -89,25 +100,42 @@ public Q_SLOTS:
     void setUseShortNames(bool useFolderName);
     void setDrawIncomingArcs(bool drawIncomingArcs);
     void setMaxLevel(int maxLevel);
+    // Levels of callers drawn as incoming arcs, 0 for no limit
+    void setMaxCallerLevel(int maxCallerLevel);
     void setShowUsesOnEdgeHover(bool checked);
 
     void refreshGraph();
+    // Called when the active document was reparsed, only changed function bodies are walked again
+    void updateGraph();
     void newGraph();
 
 private Q_SLOTS:
     void jobDone (KJob* job);
+    void processCursorPosition();
+    void prefetchDone(ThreadWeaver::Job *job);
 
 Q_SIGNALS:
     void startingJob();
     void jobDone();
 
+protected:
+    // Streams partial graphs to the view while a new graph is generated
+    virtual void lockReleased();
 private:
-    void useDeclarationsFromDefinition(Declaration *definition, TopDUContext *topContext, DUContext *context);
-    Declaration *declarationFromControlFlowMode(Declaration *definitionDeclaration);
-    void prepareContainers(QStringList &containers, Declaration* definition);
-    QString globalNamespaceOrFolderNames(Declaration *declaration);
-    QString prependFolderNames(Declaration *declaration);
-    QString shortNameFromContainers(const QList<QString> &containers, const QString &qualifiedIdentifier);
+    void showGraphAt(KTextEditor::View *view, const KTextEditor::Cursor &cursor);
+    DUContext *executableContextAt(TopDUContext *topContext, KTextEditor::View *view, const KTextEditor::Cursor &cursor);
+    DUContext *uppermostExecutableContextOf(DUContext *context);
+    void startGraphJob(const QString &jobName, bool newGraph);
+    // Patches the changed function bodies into the shown graph
+    void startUpdate(const QString &jobName, const QList<IndexedDeclaration> &changedBodies);
+    // Caches, in the background, the graphs of the functions around and called by the shown one
+    void startPrefetch();
+    void cancelPrefetch();
+    QList<IndexedDeclaration> prefetchTargets();
+    void collectFunctionDefinitions(DUContext *context, QList<Declaration *> &definitions);
+    bool showCachedGraph();
+    // Keeps the layout of the graph being left along with its cached graph
+    void cacheShownLayout();
     void updateToolTip(const QString &edge, const QPoint& point, QWidget *partWidget);
 
     QPointer<DotControlFlowGraph> m_dotControlFlowGraph;
@@ -119,30 +147,34 @@ private:
     IndexedDeclaration m_definition;
     IndexedTopDUContext m_topContext;
     IndexedDUContext m_uppermostExecutableContext;
-    
-    QSet<IndexedDeclaration> m_visitedFunctions;
-    QHash<QString, IndexedDeclaration> m_identifierDeclarationMap;
-    QMultiHash<QString, QPair<RangeInRevision, IndexedString> > m_arcUsesMap;
-    QPointer<KDevelop::IProject> m_currentProject;
-    
-    int  m_currentLevel;
-    int  m_maxLevel;
+
+    // Set from the tool view, m_settings is what the running job was started with
+    Settings m_requestedSettings;
+    QCache<GraphKey, CachedGraph> m_graphCache;
+    GraphKey m_graphKey;
+
     bool m_locked;
-    bool m_drawIncomingArcs;
-    bool m_useFolderName;
-    bool m_useShortNames;
     bool m_ShowUsesOnEdgeHover;
 
-    ControlFlowMode m_controlFlowMode;
-    ClusteringModes m_clusteringModes;
-    
     bool m_graphThreadRunning;
-    bool m_abort;
-    
-    QPointer<ControlFlowGraphUsesCollector> m_collector;
-    KDevelop::Path::List m_includeDirectories;
+    bool m_updatingGraph;
+    // Graph the running job builds, the shown one only changes on this thread
+    ControlFlowGraphData m_jobGraphData;
+    QVector<int> m_updatedClusterMap;
+    QList<IndexedDeclaration> m_changedBodies;
+    // What the shown graph was made of before the update, restored if it is aborted
+    QHash<IndexedDeclaration, int> m_previousVisitedFunctions;
+    ControlFlowGraphEdgeUses m_previousEdgeUses;
+    QHash<IndexedDeclaration, FunctionBody> m_previousFunctionBodies;
+    // The cursor moved to another function while a job was running
+    bool m_cursorPending;
+    QTimer *m_cursorTimer;
+    QPointer<KTextEditor::View> m_cursorView;
+    QPointer<ControlFlowGraphPrefetchJob> m_prefetchJob;
+    // Another prefetch was asked for while the running one was being aborted
+    bool m_prefetchPending;
+    int m_snapshotEdges;
+    QElapsedTimer m_snapshotTimer;
 };
 
-Q_DECLARE_OPERATORS_FOR_FLAGS(DUChainControlFlow::ClusteringModes)
-
 #endif
@@ -20,12 +20,11 @@
 #include "duchaincontrolflowinternaljob.h"
 
 #include "duchaincontrolflow.h"
-#include "kdevcontrolflowgraphviewplugin.h"
+#include "controlflowgraphexportjob.h"
 
-DUChainControlFlowInternalJob::DUChainControlFlowInternalJob(DUChainControlFlow *duchainControlFlow, KDevControlFlowGraphViewPlugin *plugin)
+DUChainControlFlowInternalJob::DUChainControlFlowInternalJob(DUChainControlFlow *duchainControlFlow, ControlFlowGraphExportJob *exportJob)
  : m_duchainControlFlow(duchainControlFlow),
-   m_plugin(plugin),
-   m_controlFlowJobType(DUChainControlFlowInternalJob::ControlFlowJobInteractive)
+   m_exportJob(exportJob)
 {
 }
 
@@ -33,47 +32,19 @@ DUChainControlFlowInternalJob::~DUChainControlFlowInternalJob()
 {
 }
 
-void DUChainControlFlowInternalJob::setControlFlowJobType(DUChainControlFlowInternalJob::ControlFlowJobType controlFlowJobType)
-{
-    m_controlFlowJobType = controlFlowJobType;   
-}
-
 void DUChainControlFlowInternalJob::requestAbort()
 {
-    if (m_plugin)
-    {
-        kDebug() << "Requesting abort";
-        m_plugin->requestAbort();
-    }
+    kDebug() << "Requesting abort";
+    if (m_exportJob)
+        m_exportJob->requestAbort();
+    else if (m_duchainControlFlow)
+        m_duchainControlFlow->requestAbort();
 }
 
 void DUChainControlFlowInternalJob::run()
 {
-    switch(m_controlFlowJobType)
-    {
-        case ControlFlowJobInteractive:
-        {
-            if (m_duchainControlFlow)
-                m_duchainControlFlow->run();
-            break;
-        }
-        case ControlFlowJobBatchForFunction:
-        {
-            if (m_plugin)
-                m_plugin->generateControlFlowGraph();
-            break;
-        }
-        case ControlFlowJobBatchForClass:
-        {
-            if (m_plugin)
-                m_plugin->generateClassControlFlowGraph();
-            break;
-        }
-        case ControlFlowJobBatchForProject:
-        {
-            if (m_plugin)
-                m_plugin->generateProjectControlFlowGraph();
-            break;
-        }
-    };
+    if (m_exportJob)
+        m_exportJob->generate();
+    else if (m_duchainControlFlow)
+        m_duchainControlFlow->run();
 }
@@ -23,25 +23,22 @@
 #include <ThreadWeaver/Job>
 
 class DUChainControlFlow;
-class KDevControlFlowGraphViewPlugin;
+class ControlFlowGraphExportJob;
 
 class DUChainControlFlowInternalJob : public ThreadWeaver::Job
 {
     Q_OBJECT
 public:
-    DUChainControlFlowInternalJob(DUChainControlFlow *duchainControlFlow, KDevControlFlowGraphViewPlugin *plugin);
+    // Generates an export when exportJob is given, an interactive graph otherwise
+    DUChainControlFlowInternalJob(DUChainControlFlow *duchainControlFlow, ControlFlowGraphExportJob *exportJob = 0);
     virtual ~DUChainControlFlowInternalJob();
-    
-    enum ControlFlowJobType { ControlFlowJobInteractive, ControlFlowJobBatchForFunction, ControlFlowJobBatchForClass, ControlFlowJobBatchForProject };
-    void setControlFlowJobType (ControlFlowJobType controlFlowJobType);
 
     virtual void requestAbort();
 protected:
     void run();
 private:
     DUChainControlFlow *m_duchainControlFlow;
-    KDevControlFlowGraphViewPlugin *m_plugin;
-    ControlFlowJobType m_controlFlowJobType;
+    ControlFlowGraphExportJob *m_exportJob;
 };
 
 #endif
@@ -31,18 +31,7 @@
 
 DUChainControlFlowJob::DUChainControlFlowJob(const QString &jobName, DUChainControlFlow *duchainControlFlow)
  : m_duchainControlFlow(duchainControlFlow),
-   m_plugin(0),
-   m_internalJob(0),
-   m_controlFlowJobType(DUChainControlFlowInternalJob::ControlFlowJobInteractive)
-{
-    init(jobName);
-}
-
-DUChainControlFlowJob::DUChainControlFlowJob(const QString &jobName, KDevControlFlowGraphViewPlugin *plugin)
- : m_duchainControlFlow(0),
-   m_plugin(plugin),
-   m_internalJob(0),
-   m_controlFlowJobType(DUChainControlFlowInternalJob::ControlFlowJobInteractive)
+   m_internalJob(0)
 {
     init(jobName);
 }
@@ -64,25 +53,21 @@ QString DUChainControlFlowJob::statusName() const
     return i18n("Control Flow Graph");
 }
 
-void DUChainControlFlowJob::setControlFlowJobType(DUChainControlFlowInternalJob::ControlFlowJobType controlFlowJobType)
-{
-    m_controlFlowJobType = controlFlowJobType;   
-}
-
 void DUChainControlFlowJob::start()
 {
     emit showProgress(this, 0, 0, 0);
     emit showMessage(this, objectName());
 
-    m_internalJob = new DUChainControlFlowInternalJob(m_duchainControlFlow, m_plugin);
-    m_internalJob->setControlFlowJobType(m_controlFlowJobType);
+    m_internalJob = new DUChainControlFlowInternalJob(m_duchainControlFlow);
     connect(m_internalJob, SIGNAL(done(ThreadWeaver::Job*)), SLOT(done(ThreadWeaver::Job*)));
     ThreadWeaver::Weaver::instance()->enqueue(m_internalJob);
 }
 
 bool DUChainControlFlowJob::doKill()
 {
-    m_internalJob->requestAbort();
+    // Cooperative, the job finishes through done() once the traversal notices the abort
+    if (m_internalJob)
+        m_internalJob->requestAbort();
     return false;
 }
 
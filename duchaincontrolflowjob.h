@@ -35,7 +35,6 @@ namespace ThreadWeaver
 
 class DUChainControlFlow;
 class DUChainControlFlowInternalJob;
-class KDevControlFlowGraphViewPlugin;
 
 using namespace KDevelop;
 
@@ -45,13 +44,10 @@ class DUChainControlFlowJob : public KJob, public IStatus
     Q_INTERFACES(KDevelop::IStatus)
 public:
     DUChainControlFlowJob(const QString &jobName, DUChainControlFlow *duchainControlFlow);
-    DUChainControlFlowJob(const QString &jobName, KDevControlFlowGraphViewPlugin *plugin);
     virtual ~DUChainControlFlowJob();
 
     virtual QString statusName() const;
 
-    void setControlFlowJobType(DUChainControlFlowInternalJob::ControlFlowJobType controlFlowJobType);
-    
     virtual void start();
     virtual bool doKill();
 Q_SIGNALS:
@@ -66,9 +62,7 @@ private Q_SLOTS:
 private:
     void init(const QString &jobName);
     DUChainControlFlow *m_duchainControlFlow;
-    KDevControlFlowGraphViewPlugin *m_plugin;
     QPointer<DUChainControlFlowInternalJob> m_internalJob;
-    DUChainControlFlowInternalJob::ControlFlowJobType m_controlFlowJobType;
 };
 
 #endif
@@ -24,6 +24,7 @@
 #include <KLocale>
 #include <KAboutData>
 #include <KMessageBox>
+#include <KConfigGroup>
 #include <KGenericFactory>
 
 #include <interfaces/icore.h>
@@ -37,13 +38,10 @@
 #include <interfaces/idocumentcontroller.h>
 #include <interfaces/contextmenuextension.h>
 
-#include <language/duchain/codemodel.h>
 #include <language/duchain/declaration.h>
 #include <language/duchain/classdeclaration.h>
 #include <language/duchain/types/functiontype.h>
 #include <language/duchain/functiondefinition.h>
-#include <language/duchain/persistentsymboltable.h>
-#include <language/duchain/classfunctiondeclaration.h>
 
 #include <language/interfaces/codecontext.h>
 
@@ -55,9 +53,10 @@
 #include <KTextEditor/Document>
 
 #include "duchaincontrolflow.h"
-#include "dotcontrolflowgraph.h"
 #include "controlflowgraphview.h"
-#include "duchaincontrolflowjob.h"
+#include "controlflowgraphindex.h"
+#include "controlflowgraphexportjob.h"
+#include "controlflowgraphlocationresolver.h"
 
 using namespace KDevelop;
 
@@ -87,9 +86,7 @@ KDevControlFlowGraphViewPlugin::KDevControlFlowGraphViewPlugin (QObject *parent,
 :
 KDevelop::IPlugin (ControlFlowGraphViewFactory::componentData(), parent),
 m_toolViewFactory(new KDevControlFlowGraphViewFactory(this)),
-m_activeToolView(0),
-m_project(0),
-m_abort(false)
+m_activeToolView(0)
 {
     core()->uiController()->addToolView(i18n("Control Flow Graph"), m_toolViewFactory);
 
@@ -110,10 +107,21 @@ m_abort(false)
 
     m_exportProjectControlFlowGraph = new QAction(i18n("Export Project Control Flow Graph"), this);
     connect(m_exportProjectControlFlowGraph, SIGNAL(triggered(bool)), SLOT(slotExportProjectControlFlowGraph(bool)), Qt::UniqueConnection);
+
+    foreach (IProject *project, core()->projectController()->projects())
+        m_callGraphIndexes.insert(project, new ControlFlowGraphIndex(project, this));
+
+    m_locationResolver = new ControlFlowGraphLocationResolver(this);
+    m_renderCache = new ControlFlowGraphRenderCache;
+
+    // Each export may start its own graphviz processes, so only a few run at once
+    m_maxConcurrentExports = qMax(1, KConfigGroup(KGlobal::config(), "Control Flow Graph").readEntry("ConcurrentExports", 2));
 }
 
 KDevControlFlowGraphViewPlugin::~KDevControlFlowGraphViewPlugin()
 {
+    qDeleteAll(m_callGraphIndexes);
+    delete m_renderCache;
 }
 
 QString KDevControlFlowGraphViewPlugin::statusName() const
@@ -139,7 +147,7 @@ void KDevControlFlowGraphViewPlugin::unRegisterToolView(ControlFlowGraphView *vi
 
 QPointer<ControlFlowGraphFileDialog> KDevControlFlowGraphViewPlugin::exportControlFlowGraph(ControlFlowGraphFileDialog::OpeningMode mode)
 {
-    QPointer<ControlFlowGraphFileDialog> fileDialog = new ControlFlowGraphFileDialog(KUrl(), "*.png|PNG (Portable Network Graphics)\n*.jpg *.jpeg|JPG \\/ JPEG (Joint Photographic Expert Group)\n*.gif|GIF (Graphics Interchange Format)\n*.svg *.svgz|SVG (Scalable Vector Graphics)\n*.dia|DIA (Dia Structured Diagrams)\n*.fig|FIG\n*.pdf|PDF (Portable Document Format)\n*.dot|DOT (Graph Description Language)", (QWidget *) ICore::self()->uiController()->activeMainWindow(), i18n("Export Control Flow Graph"), mode);
+    QPointer<ControlFlowGraphFileDialog> fileDialog = new ControlFlowGraphFileDialog(KUrl(), "*.png|PNG (Portable Network Graphics)\n*.jpg *.jpeg|JPG \\/ JPEG (Joint Photographic Expert Group)\n*.gif|GIF (Graphics Interchange Format)\n*.svg *.svgz|SVG (Scalable Vector Graphics)\n*.dia|DIA (Dia Structured Diagrams)\n*.fig|FIG\n*.pdf|PDF (Portable Document Format)\n*.dot *.dot.gz|DOT (Graph Description Language)\n*.graphml *.graphml.gz|GraphML\n*.jsonl *.jsonl.gz|JSON Lines", (QWidget *) ICore::self()->uiController()->activeMainWindow(), i18n("Export Control Flow Graph"), mode);
     if (fileDialog->exec() == QDialog::Accepted)
     {
         if (fileDialog)
@@ -204,7 +212,8 @@ KDevControlFlowGraphViewPlugin::contextMenuExtension(KDevelop::Context* context)
 
 void KDevControlFlowGraphViewPlugin::projectOpened(KDevelop::IProject* project)
 {
-    Q_UNUSED(project);
+    if (!m_callGraphIndexes.contains(project))
+        m_callGraphIndexes.insert(project, new ControlFlowGraphIndex(project, this));
     foreach (ControlFlowGraphView *controlFlowGraphView, m_toolViews)
         controlFlowGraphView->setProjectButtonsEnabled(true);
     refreshActiveToolView();
@@ -212,7 +221,7 @@ void KDevControlFlowGraphViewPlugin::projectOpened(KDevelop::IProject* project)
 
 void KDevControlFlowGraphViewPlugin::projectClosed(KDevelop::IProject* project)
 {
-    Q_UNUSED(project);
+    delete m_callGraphIndexes.take(project);
     if (core()->projectController()->projectCount() == 0)
     {
         foreach (ControlFlowGraphView *controlFlowGraphView, m_toolViews)
@@ -226,9 +235,13 @@ void KDevControlFlowGraphViewPlugin::projectClosed(KDevelop::IProject* project)
 
 void KDevControlFlowGraphViewPlugin::parseJobFinished(KDevelop::ParseJob* parseJob)
 {
+    foreach (ControlFlowGraphIndex *callGraphIndex, m_callGraphIndexes)
+        callGraphIndex->parseJobFinished(parseJob);
+
     if (core()->documentController()->activeDocument() &&
-        parseJob->document().toUrl() == core()->documentController()->activeDocument()->url())
-        refreshActiveToolView();
+        parseJob->document().toUrl() == core()->documentController()->activeDocument()->url() &&
+        m_activeToolView)
+        m_activeToolView->updateGraph();
 }
 
 void KDevControlFlowGraphViewPlugin::textDocumentCreated(KDevelop::IDocument *document)
@@ -276,12 +289,6 @@ void KDevControlFlowGraphViewPlugin::slotExportControlFlowGraph(bool value)
     // Export graph for a given function
     Q_UNUSED(value);
 
-    if (m_duchainControlFlow || m_dotControlFlowGraph)
-    {
-        KMessageBox::error((QWidget *) core()->uiController()->activeMainWindow(), i18n("There is a graph being currently exported. Please stop it before requiring a new one"));
-        return;
-    }
-
     DUChainReadLocker lock(DUChain::lock());
 
     Q_ASSERT(qobject_cast<QAction *>(sender()));
@@ -305,14 +312,14 @@ void KDevControlFlowGraphViewPlugin::slotExportControlFlowGraph(bool value)
             return;
         }
     }
-    if ((m_fileDialog = exportControlFlowGraph()))
+    QPointer<ControlFlowGraphFileDialog> fileDialog;
+    if ((fileDialog = exportControlFlowGraph()))
     {
-        DUChainControlFlowJob *job = new DUChainControlFlowJob(declaration->qualifiedIdentifier().toString(), this);
-        job->setControlFlowJobType(DUChainControlFlowInternalJob::ControlFlowJobBatchForFunction);
-        m_ideclaration = IndexedDeclaration(declaration);
-        connect (job, SIGNAL(result(KJob*)), SLOT(generationDone(KJob*)));
-        ICore::self()->runController()->registerJob(job);
+        ControlFlowGraphExportJob *job = new ControlFlowGraphExportJob(this, declaration->qualifiedIdentifier().toString(), fileDialog);
+        job->setFunction(IndexedDeclaration(declaration));
+        queueExport(job);
     }
+    delete fileDialog;
     action->setData(QVariant::fromValue(DUChainBasePointer()));
 }
 
@@ -321,12 +328,6 @@ void KDevControlFlowGraphViewPlugin::slotExportClassControlFlowGraph(bool value)
     // Export graph for all functions of a given class - individual per-function graphs will be merged
     Q_UNUSED(value);
 
-    if (m_duchainControlFlow || m_dotControlFlowGraph)
-    {
-        KMessageBox::error((QWidget *) core()->uiController()->activeMainWindow(), i18n("There is a graph being currently exported. Please stop it before requiring a new one"));
-        return;
-    }
-
     DUChainReadLocker lock(DUChain::lock());
 
     Q_ASSERT(qobject_cast<QAction *>(sender()));
@@ -341,14 +342,14 @@ void KDevControlFlowGraphViewPlugin::slotExportClassControlFlowGraph(bool value)
         return;
     }
 
-    if ((m_fileDialog = exportControlFlowGraph(ControlFlowGraphFileDialog::ForClassConfigurationButtons)))
+    QPointer<ControlFlowGraphFileDialog> fileDialog;
+    if ((fileDialog = exportControlFlowGraph(ControlFlowGraphFileDialog::ForClassConfigurationButtons)))
     {
-        DUChainControlFlowJob *job = new DUChainControlFlowJob(declaration->qualifiedIdentifier().toString(), this);
-        job->setControlFlowJobType(DUChainControlFlowInternalJob::ControlFlowJobBatchForClass);
-        m_ideclaration = IndexedDeclaration(declaration);
-        connect (job, SIGNAL(result(KJob*)), SLOT(generationDone(KJob*)));
-        ICore::self()->runController()->registerJob(job);
+        ControlFlowGraphExportJob *job = new ControlFlowGraphExportJob(this, declaration->qualifiedIdentifier().toString(), fileDialog);
+        job->setClass(IndexedDeclaration(declaration));
+        queueExport(job);
     }
+    delete fileDialog;
     action->setData(QVariant::fromValue(DUChainBasePointer()));
 }
 
@@ -357,12 +358,6 @@ void KDevControlFlowGraphViewPlugin::slotExportProjectControlFlowGraph(bool valu
     // Export graph for all classes of a given project - individual per-class graphs will be merged
     Q_UNUSED(value);
 
-    if (m_duchainControlFlow || m_dotControlFlowGraph)
-    {
-        KMessageBox::error((QWidget *) core()->uiController()->activeMainWindow(), i18n("There is a graph being currently exported. Please stop it before requiring a new one"));
-        return;
-    }
-
     Q_ASSERT(qobject_cast<QAction *>(sender()));
     QAction *action = static_cast<QAction *>(sender());
     Q_ASSERT(action->data().canConvert<QString>());
@@ -382,195 +377,83 @@ void KDevControlFlowGraphViewPlugin::slotExportProjectControlFlowGraph(bool valu
         return;
     }
 
-    if ((m_fileDialog = exportControlFlowGraph(ControlFlowGraphFileDialog::ForClassConfigurationButtons)))
+    QPointer<ControlFlowGraphFileDialog> fileDialog;
+    if ((fileDialog = exportControlFlowGraph(ControlFlowGraphFileDialog::ForClassConfigurationButtons)))
     {
-        DUChainControlFlowJob *job = new DUChainControlFlowJob(projectName, this);
-        job->setControlFlowJobType(DUChainControlFlowInternalJob::ControlFlowJobBatchForProject);
-        m_project = project;
-        connect (job, SIGNAL(result(KJob*)), SLOT(generationDone(KJob*)));
-        ICore::self()->runController()->registerJob(job);
+        ControlFlowGraphExportJob *job = new ControlFlowGraphExportJob(this, projectName, fileDialog);
+        job->setProject(project, m_callGraphIndexes.value(project));
+        queueExport(job);
     }
+    delete fileDialog;
     action->setData(QVariant::fromValue(QString()));
 }
 
-void KDevControlFlowGraphViewPlugin::generateControlFlowGraph()
+void KDevControlFlowGraphViewPlugin::setActiveToolView(ControlFlowGraphView *activeToolView)
 {
-    DUChainReadLocker readLock(DUChain::lock());
-
-    Declaration *declaration = m_ideclaration.data();
-    if (!declaration)
-        return;
-
-    m_abort = false;
-    m_dotControlFlowGraph = new DotControlFlowGraph;
-    m_duchainControlFlow = new DUChainControlFlow(m_dotControlFlowGraph);
-
-    configureDuchainControlFlow(m_duchainControlFlow, m_dotControlFlowGraph, m_fileDialog);
-
-    m_duchainControlFlow->generateControlFlowForDeclaration(m_ideclaration, IndexedTopDUContext(declaration->topContext()), IndexedDUContext(declaration->internalContext()));
-    exportGraph();
+    m_activeToolView = activeToolView;
+    refreshActiveToolView();
 }
 
-void KDevControlFlowGraphViewPlugin::generateClassControlFlowGraph()
+void KDevControlFlowGraphViewPlugin::queueExport(ControlFlowGraphExportJob *job)
 {
-    DUChainReadLocker readLock(DUChain::lock());
-
-    Declaration *declaration = m_ideclaration.data();
-    if (!declaration)
-        return;
-
-    m_abort = false;
-    m_dotControlFlowGraph = new DotControlFlowGraph;
-    m_duchainControlFlow = new DUChainControlFlow(m_dotControlFlowGraph);
-    
-    configureDuchainControlFlow(m_duchainControlFlow, m_dotControlFlowGraph, m_fileDialog);
-
-    if (!declaration->isForwardDeclaration() && declaration->internalContext())
-    {
-        int i = 0;
-        int max = declaration->internalContext()->localDeclarations().size();
-        // For each function declaration
-        ClassFunctionDeclaration *functionDeclaration;
-        foreach (Declaration *decl, declaration->internalContext()->localDeclarations())
-        {
-            if (m_abort)
-                break;
-
-            emit showProgress(this, 0, max-1, i);
-            emit showMessage(this, i18n("Generating graph for function %1", decl->identifier().toString()));
-            ++i;
-            if ((functionDeclaration = dynamic_cast<ClassFunctionDeclaration *>(decl)))
-            {
-                Declaration *functionDefinition = FunctionDefinition::definition(functionDeclaration);
-                if (functionDefinition)
-                    m_duchainControlFlow->generateControlFlowForDeclaration(IndexedDeclaration(functionDefinition), IndexedTopDUContext(functionDefinition->topContext()), IndexedDUContext(functionDefinition->internalContext()));
-            }
-        }
-    }
-    if (!m_abort)
-    {
-        emit showMessage(this, i18n("Saving file %1", m_fileDialog->selectedFile()));
-        exportGraph();
-    }
-    emit hideProgress(this);
-    emit clearMessage(this);
+    connect(job, SIGNAL(result(KJob*)), SLOT(exportDone(KJob*)));
+    ICore::self()->runController()->registerJob(job);
 }
 
-void KDevControlFlowGraphViewPlugin::generateProjectControlFlowGraph()
+void KDevControlFlowGraphViewPlugin::scheduleExport(ControlFlowGraphExportJob *job)
 {
-    if (!m_project)
-        return;
-
-    m_abort = false;
-    m_dotControlFlowGraph = new DotControlFlowGraph;
-    m_duchainControlFlow = new DUChainControlFlow(m_dotControlFlowGraph);
-
-    configureDuchainControlFlow(m_duchainControlFlow, m_dotControlFlowGraph, m_fileDialog);
-
-    DUChainReadLocker readLock(DUChain::lock());
-
-    int i = 0;
-    int max = m_project->fileSet().size();
-    // For each source file
-    foreach(const IndexedString &file, m_project->fileSet())
-    {
-        emit showProgress(this, 0, max-1, i);
-        ++i;
-
-        uint codeModelItemCount = 0;
-        const CodeModelItem *codeModelItems = 0;
-        CodeModel::self().items(file, codeModelItemCount, codeModelItems);
-        
-        for (uint codeModelItemIndex = 0; codeModelItemIndex < codeModelItemCount; ++codeModelItemIndex)
-        {
-            const CodeModelItem &item = codeModelItems[codeModelItemIndex];
-            
-            if ((item.kind & CodeModelItem::Class) && !item.id.identifier().last().toString().isEmpty())
-            {
-                uint declarationCount = 0;
-                const IndexedDeclaration *declarations = 0;
-                PersistentSymbolTable::self().declarations(item.id.identifier(), declarationCount, declarations);
-                // For each class declaration
-                for (uint j = 0; j < declarationCount; ++j)
-                {
-                    Declaration *declaration = dynamic_cast<Declaration *>(declarations[j].declaration());
-                    if (declaration && !declaration->isForwardDeclaration() && declaration->internalContext())
-                    {
-                        // For each function declaration
-                        ClassFunctionDeclaration *functionDeclaration;
-                        foreach (Declaration *decl, declaration->internalContext()->localDeclarations())
-                        {
-                            emit showMessage(this, i18n("Generating graph for %1 - %2", file.str(), decl->qualifiedIdentifier().toString()));
-                            if ((functionDeclaration = dynamic_cast<ClassFunctionDeclaration *>(decl)))
-                            {
-                                if (m_abort)
-                                    break;
-                                
-                                Declaration *functionDefinition = FunctionDefinition::definition(functionDeclaration);
-                                if (functionDefinition)
-                                    m_duchainControlFlow->generateControlFlowForDeclaration(IndexedDeclaration(functionDefinition), IndexedTopDUContext(functionDefinition->topContext()), IndexedDUContext(functionDefinition->internalContext()));
-                            }
-                        }
-                        if (m_abort)
-                            break;
-                    }
-                }
-                if (m_abort)
-                    break;
-            }
-        }
-        if (m_abort)
-            break;
-    }
-    if (!m_abort)
-    {
-        emit showMessage(this, i18n("Saving file %1", m_fileDialog->selectedFile()));
-        exportGraph();
-    }
-    m_project = 0;
-    emit hideProgress(this);
-    emit clearMessage(this);
+    m_queuedExports.enqueue(job);
+    startQueuedExports();
 }
 
-void KDevControlFlowGraphViewPlugin::requestAbort()
+bool KDevControlFlowGraphViewPlugin::unscheduleExport(ControlFlowGraphExportJob *job)
 {
-    m_abort = true;
+    return m_queuedExports.removeAll(job) > 0;
 }
 
-void KDevControlFlowGraphViewPlugin::setActiveToolView(ControlFlowGraphView *activeToolView)
+void KDevControlFlowGraphViewPlugin::startQueuedExports()
 {
-    m_activeToolView = activeToolView;
-    refreshActiveToolView();
+    while (!m_queuedExports.isEmpty() && m_runningExports.size() < m_maxConcurrentExports)
+    {
+        ControlFlowGraphExportJob *job = m_queuedExports.dequeue();
+        m_runningExports.append(job);
+        job->run();
+    }
 }
 
-void KDevControlFlowGraphViewPlugin::generationDone(KJob *job)
+void KDevControlFlowGraphViewPlugin::exportDone(KJob *job)
 {
     job->deleteLater();
 
-    delete m_dotControlFlowGraph;
-    delete m_duchainControlFlow;
+    ControlFlowGraphExportJob *exportJob = static_cast<ControlFlowGraphExportJob *>(job);
+    m_runningExports.removeAll(exportJob);
+    m_queuedExports.removeAll(exportJob);
+    startQueuedExports();
+
+    if (job->error() || exportJob->isAborted())
+        return;
 
-    if (!m_abort)
+    if (exportJob->hit() == ControlFlowGraphRenderCache::Failed)
+        KMessageBox::error((QWidget *) (core()->uiController()->activeMainWindow()),
+                           i18n("Could not lay out %1, graphviz failed or exceeded its limits", exportJob->selectedFile()),
+                           i18n("Export Control Flow Graph"));
+    else
         KMessageBox::information((QWidget *) (core()->uiController()->activeMainWindow()),
-                                 i18n("Control flow graph exported"),
+                                 i18n("Control flow graph exported to %1", exportJob->selectedFile()),
                                  i18n("Export Control Flow Graph"));
 }
 
-void KDevControlFlowGraphViewPlugin::exportGraph()
+ControlFlowGraphLocationResolver *KDevControlFlowGraphViewPlugin::locationResolver() const
+{
+    return m_locationResolver;
+}
+
+ControlFlowGraphRenderCache *KDevControlFlowGraphViewPlugin::renderCache() const
 {
-    DotControlFlowGraph::mutex.lock();
-    m_dotControlFlowGraph->exportGraph(m_fileDialog->selectedFile());
-    DotControlFlowGraph::mutex.unlock();
+    return m_renderCache;
 }
 
-void KDevControlFlowGraphViewPlugin::configureDuchainControlFlow(DUChainControlFlow *duchainControlFlow, DotControlFlowGraph *dotControlFlowGraph, ControlFlowGraphFileDialog *fileDialog)
+ControlFlowGraphIndex *KDevControlFlowGraphViewPlugin::callGraphIndex(IProject *project) const
 {
-    duchainControlFlow->setControlFlowMode(fileDialog->controlFlowMode());
-    duchainControlFlow->setClusteringModes(fileDialog->clusteringModes());
-    duchainControlFlow->setMaxLevel(fileDialog->maxLevel());
-    duchainControlFlow->setUseFolderName(fileDialog->useFolderName());
-    duchainControlFlow->setUseShortNames(fileDialog->useShortNames());
-    duchainControlFlow->setDrawIncomingArcs(fileDialog->drawIncomingArcs());
-
-    dotControlFlowGraph->prepareNewGraph();
+    return m_callGraphIndexes.value(project);
 }
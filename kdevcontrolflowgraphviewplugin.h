@@ -20,8 +20,10 @@
 #ifndef KDEVCONTROLFLOWGRAPHVIEWPLUGIN_H
 #define KDEVCONTROLFLOWGRAPHVIEWPLUGIN_H
 
-#include <QVariant>
+#include <QHash>
 #include <QList>
+#include <QQueue>
+#include <QVariant>
 
 #include <interfaces/iplugin.h>
 #include <interfaces/istatus.h>
@@ -46,10 +48,13 @@ namespace KTextEditor
     class Cursor;
 }
 
+class KJob;
 class ControlFlowGraphView;
-class DUChainControlFlow;
-class DotControlFlowGraph;
 class ControlFlowGraphFileDialog;
+class ControlFlowGraphIndex;
+class ControlFlowGraphExportJob;
+class ControlFlowGraphLocationResolver;
+class ControlFlowGraphRenderCache;
 
 using namespace KDevelop;
 
@@ -67,12 +72,18 @@ public:
     void registerToolView(ControlFlowGraphView *view);
     void unRegisterToolView(ControlFlowGraphView *view);
     QPointer<ControlFlowGraphFileDialog> exportControlFlowGraph(ControlFlowGraphFileDialog::OpeningMode mode = ControlFlowGraphFileDialog::ConfigurationButtons);
+    ControlFlowGraphLocationResolver *locationResolver() const;
+    ControlFlowGraphRenderCache *renderCache() const;
+    ControlFlowGraphIndex *callGraphIndex(IProject *project) const;
+
+    // Registers job with the run controller, which starts it
+    void queueExport(ControlFlowGraphExportJob *job);
+    // Runs job now or once a running export finishes
+    void scheduleExport(ControlFlowGraphExportJob *job);
+    // Returns true if job was still waiting and won't run anymore
+    bool unscheduleExport(ControlFlowGraphExportJob *job);
 
     KDevelop::ContextMenuExtension contextMenuExtension(KDevelop::Context* context);
-    void generateControlFlowGraph();
-    void generateClassControlFlowGraph();
-    void generateProjectControlFlowGraph();
-    void requestAbort();
 public Q_SLOTS:
     void projectOpened(KDevelop::IProject* project);
     void projectClosed(KDevelop::IProject* project);
@@ -88,8 +99,7 @@ public Q_SLOTS:
     void slotExportClassControlFlowGraph(bool value);
     void slotExportProjectControlFlowGraph(bool value);
     void setActiveToolView(ControlFlowGraphView *activeToolView);
-    void generationDone(KJob *job);
-    void exportGraph();
+    void exportDone(KJob *job);
 Q_SIGNALS:
     // Implementations of IStatus signals
     void clearMessage(KDevelop::IStatus*);
@@ -98,7 +108,7 @@ Q_SIGNALS:
     void showProgress(KDevelop::IStatus*, int minimum, int maximum, int value);
     void showErrorMessage(const QString&, int);
 private:
-    void configureDuchainControlFlow(DUChainControlFlow *duchainControlFlow, DotControlFlowGraph *dotControlFlowGraph, ControlFlowGraphFileDialog *fileDialog);
+    void startQueuedExports();
 
     ControlFlowGraphView *activeToolView();
     KDevControlFlowGraphViewFactory *m_toolViewFactory;
@@ -107,16 +117,14 @@ private:
     QAction *m_exportControlFlowGraph;
     QAction *m_exportClassControlFlowGraph;
     QAction *m_exportProjectControlFlowGraph;
-    
-    IndexedDeclaration m_ideclaration;
-    IProject *m_project;
-    
-    QPointer<DUChainControlFlow> m_duchainControlFlow;
-    QPointer<DotControlFlowGraph> m_dotControlFlowGraph;
 
-    ControlFlowGraphFileDialog *m_fileDialog;
+    QHash<IProject *, ControlFlowGraphIndex *> m_callGraphIndexes;
+    ControlFlowGraphLocationResolver *m_locationResolver;
+    ControlFlowGraphRenderCache *m_renderCache;
 
-    bool m_abort;
+    QList<ControlFlowGraphExportJob *> m_runningExports;
+    QQueue<ControlFlowGraphExportJob *> m_queuedExports;
+    int m_maxConcurrentExports;
 };
 
 #endif